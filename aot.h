@@ -0,0 +1,38 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __AOT_H__
+#define __AOT_H__
+
+#include "intern.h"
+
+struct Logic;
+
+// generated by aotgen, runs a script slot like Logic::executeScript()
+typedef void (*AotProc)(Logic *log);
+
+struct AotPart {
+	uint16 ptrsId;
+	uint16 size;
+	uint32 checksum;
+	AotProc proc;
+};
+
+extern const AotPart g_aotParts[];
+
+#endif
@@ -0,0 +1,255 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "aot.h"
+#include "decoder.h"
+#include "resource.h"
+#include "util.h"
+
+
+static const char *USAGE = 
+	"Raw - Another World Interpreter, script compiler\n"
+	"Usage: aotgen [OPTIONS]...\n"
+	"  --datapath=PATH   Path to where the game is installed (default '.')\n"
+	"  --output=FILE     Generated C++ file (default 'aotparts.cpp')\n";
+
+#ifdef USE_AOT_SCRIPTS
+// aotgen links the engine objects, the generated table is not available yet
+const AotPart g_aotParts[] = {
+	{ 0, 0, 0, 0 }
+};
+#endif
+
+static const char *_condTable[] = { "==", "!=", ">", ">=", "<", "<=" };
+
+static bool parseOption(const char *arg, const char *longCmd, const char **opt) {
+	bool ret = false;
+	if (arg[0] == '-' && arg[1] == '-') {
+		if (strncmp(arg + 2, longCmd, strlen(longCmd)) == 0) {
+			*opt = arg + 2 + strlen(longCmd);
+			ret = true;
+		}
+	}
+	return ret;
+}
+
+static void emitInterpret(FILE *fp, const DecodedOp *op) {
+	fprintf(fp, "\t\tl->_scriptPtr.pc = seg + 0x%X;\n", op->pos);
+	fprintf(fp, "\t\tl->executeOpcode();\n");
+	fprintf(fp, "\t\tif (l->_scriptHalted || !l->_aot) return;\n");
+	fprintf(fp, "\t\tpos = l->_scriptPtr.pc - seg;\n");
+	fprintf(fp, "\t\tgoto dispatch;\n");
+}
+
+static void emitOp(FILE *fp, const Decoder *dec, const DecodedOp *op) {
+	const uint16 *a = op->args;
+	uint16 t = dec->_ops[op->target].pos;
+	switch (op->opcode) {
+	case 0x00: // op_movConst
+		fprintf(fp, "\t\tv[0x%02X] = (int16)0x%04X;\n", a[0], a[1]);
+		break;
+	case 0x01: // op_mov
+		fprintf(fp, "\t\tv[0x%02X] = v[0x%02X];\n", a[0], a[1]);
+		break;
+	case 0x02: // op_add
+		fprintf(fp, "\t\tv[0x%02X] += v[0x%02X];\n", a[0], a[1]);
+		break;
+	case 0x03: // op_addConst
+		fprintf(fp, "\t\tv[0x%02X] += (int16)0x%04X;\n", a[0], a[1]);
+		break;
+	case 0x04: // op_call
+		fprintf(fp, "\t\tl->_scriptStackCalls[l->_stackPtr] = 0x%X;\n", op->next);
+		fprintf(fp, "\t\tif (l->_stackPtr == 0xFF) error(\"Logic::op_call() ec=0x%%X stack overflow\", 0x8F);\n");
+		fprintf(fp, "\t\t++l->_stackPtr;\n");
+		fprintf(fp, "\t\tgoto L_%04X;\n", t);
+		break;
+	case 0x05: // op_ret
+		fprintf(fp, "\t\tif (l->_stackPtr == 0) error(\"Logic::op_ret() ec=0x%%X stack underflow\", 0x8F);\n");
+		fprintf(fp, "\t\t--l->_stackPtr;\n");
+		fprintf(fp, "\t\tpos = l->_scriptStackCalls[l->_stackPtr];\n");
+		fprintf(fp, "\t\tgoto dispatch;\n");
+		break;
+	case 0x06: // op_break
+		fprintf(fp, "\t\tl->_scriptPtr.pc = seg + 0x%X;\n", op->next);
+		fprintf(fp, "\t\tl->_scriptHalted = true;\n");
+		fprintf(fp, "\t\treturn;\n");
+		break;
+	case 0x07: // op_jmp
+	case Decoder::DOP_GOTO:
+		fprintf(fp, "\t\tgoto L_%04X;\n", t);
+		break;
+	case 0x08: // op_setScriptSlot
+		fprintf(fp, "\t\tl->setScriptSlot(0x%02X, 0x%04X);\n", a[0], a[1]);
+		break;
+	case 0x09: // op_jnz
+		fprintf(fp, "\t\tif (--v[0x%02X] != 0) goto L_%04X;\n", a[0], t);
+		break;
+	case 0x0A: // op_condJmp
+		if (op->flags & Decoder::DF_COND_VAR) {
+			fprintf(fp, "\t\tif (v[0x%02X] %s v[0x%02X]) goto L_%04X;\n", a[0], _condTable[op->flags & Decoder::DF_COND_MASK], a[1], t);
+		} else {
+			fprintf(fp, "\t\tif (v[0x%02X] %s (int16)0x%04X) goto L_%04X;\n", a[0], _condTable[op->flags & Decoder::DF_COND_MASK], a[1], t);
+		}
+		break;
+	case 0x11: // op_halt
+		fprintf(fp, "\t\tl->_scriptPtr.pc = seg + 0xFFFF;\n");
+		fprintf(fp, "\t\tl->_scriptHalted = true;\n");
+		fprintf(fp, "\t\treturn;\n");
+		break;
+	case 0x13: // op_sub
+		fprintf(fp, "\t\tv[0x%02X] -= v[0x%02X];\n", a[0], a[1]);
+		break;
+	case 0x14: // op_and
+		fprintf(fp, "\t\tv[0x%02X] = (uint16)v[0x%02X] & 0x%04X;\n", a[0], a[0], a[1]);
+		break;
+	case 0x15: // op_or
+		fprintf(fp, "\t\tv[0x%02X] = (uint16)v[0x%02X] | 0x%04X;\n", a[0], a[0], a[1]);
+		break;
+	case 0x16: // op_shl, the count is masked like the interpreter's 'shl eax, cl'
+		fprintf(fp, "\t\tv[0x%02X] = (uint16)((unsigned int)(uint16)v[0x%02X] << %d);\n", a[0], a[0], a[1] & 31);
+		break;
+	case 0x17: // op_shr
+		fprintf(fp, "\t\tv[0x%02X] = (uint16)v[0x%02X] >> %d;\n", a[0], a[0], a[1] & 31);
+		break;
+	case Decoder::DOP_VIDEO_80:
+		fprintf(fp, "\t\tl->_res->_useSegVideo2 = false;\n");
+		fprintf(fp, "\t\tl->_vid->setDataBuffer(l->_res->_segVideo1, 0x%X);\n", a[0]);
+		fprintf(fp, "\t\tl->_vid->drawShape(0xFF, 0x40, Point(%d, %d));\n", (int16)a[1], (int16)a[2]);
+		break;
+	case Decoder::DOP_VIDEO_40: {
+			char x[16], y[16], zoom[16];
+			if (op->flags & Decoder::DF_X_VAR) {
+				sprintf(x, "v[0x%02X]", a[1]);
+			} else {
+				sprintf(x, "%d", (int16)a[1]);
+			}
+			if (op->flags & Decoder::DF_Y_VAR) {
+				sprintf(y, "v[0x%02X]", a[2]);
+			} else {
+				sprintf(y, "%d", (int16)a[2]);
+			}
+			if (op->flags & Decoder::DF_ZOOM_VAR) {
+				sprintf(zoom, "v[0x%02X]", a[3]);
+			} else {
+				sprintf(zoom, "0x%X", a[3]);
+			}
+			bool seg2 = (op->flags & Decoder::DF_SEG_VIDEO2) != 0;
+			fprintf(fp, "\t\tl->_res->_useSegVideo2 = %s;\n", seg2 ? "true" : "false");
+			fprintf(fp, "\t\tl->_vid->setDataBuffer(l->_res->%s, 0x%X);\n", seg2 ? "_segVideo2" : "_segVideo1", a[0]);
+			fprintf(fp, "\t\tl->_vid->drawShape(0xFF, %s, Point(%s, %s));\n", zoom, x, y);
+		}
+		break;
+	default:
+		emitInterpret(fp, op);
+		break;
+	}
+}
+
+static void emitPart(FILE *fp, const Decoder *dec) {
+	// only emit the labels referenced by a goto, to keep the compiler quiet
+	static bool targets[0x10000];
+	memset(targets, 0, sizeof(targets));
+	for (uint16 i = 0; i < dec->_numOps; ++i) {
+		const DecodedOp *op = &dec->_ops[i];
+		switch (op->opcode) {
+		case 0x04: // op_call
+		case 0x07: // op_jmp
+		case 0x09: // op_jnz
+		case 0x0A: // op_condJmp
+		case Decoder::DOP_GOTO:
+			targets[dec->_ops[op->target].pos] = true;
+			break;
+		}
+	}
+	fprintf(fp, "static void aot_%04X(Logic *l) {\n", dec->_ptrsId);
+	fprintf(fp, "\tuint8 *seg = l->_res->_segCode;\n");
+	fprintf(fp, "\tint16 *v = l->_scriptVars;\n");
+	fprintf(fp, "\tuint16 pos = l->_scriptPtr.pc - seg;\n");
+	fprintf(fp, "dispatch:\n");
+	fprintf(fp, "\tswitch (pos) {\n");
+	for (uint16 i = 0; i < dec->_numOps; ++i) {
+		const DecodedOp *op = &dec->_ops[i];
+		if (op->opcode != Decoder::DOP_GOTO) {
+			fprintf(fp, "\tcase 0x%X:\n", op->pos);
+			if (targets[op->pos]) {
+				fprintf(fp, "\tL_%04X:\n", op->pos);
+			}
+		}
+		emitOp(fp, dec, op);
+	}
+	fprintf(fp, "\tdefault:\n");
+	fprintf(fp, "\t\tl->_scriptPtr.pc = seg + pos;\n");
+	fprintf(fp, "\t\tl->executeOpcode();\n");
+	fprintf(fp, "\t\tif (l->_scriptHalted || !l->_aot) return;\n");
+	fprintf(fp, "\t\tpos = l->_scriptPtr.pc - seg;\n");
+	fprintf(fp, "\t\tgoto dispatch;\n");
+	fprintf(fp, "\t}\n");
+	fprintf(fp, "}\n\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *dataPath = ".";
+	const char *outputFile = "aotparts.cpp";
+	for (int i = 1; i < argc; ++i) {
+		bool opt = false;
+		if (strlen(argv[i]) >= 2) {
+			opt |= parseOption(argv[i], "datapath=", &dataPath);
+			opt |= parseOption(argv[i], "output=", &outputFile);
+		}
+		if (!opt) {
+			printf(USAGE);
+			return 0;
+		}
+	}
+	g_debugMask = DBG_INFO;
+	Resource res(0, dataPath);
+	res.allocMemBlock();
+	res.readEntries();
+	res._curPtrsId = 0;
+	FILE *fp = fopen(outputFile, "w");
+	if (!fp) {
+		error("Unable to open '%s' for writing", outputFile);
+	}
+	fprintf(fp, "/* generated by aotgen, do not edit */\n\n");
+	fprintf(fp, "#include \"aot.h\"\n");
+	fprintf(fp, "#include \"logic.h\"\n");
+	fprintf(fp, "#include \"resource.h\"\n");
+	fprintf(fp, "#include \"util.h\"\n");
+	fprintf(fp, "#include \"video.h\"\n\n");
+	uint32 checksums[10];
+	uint16 sizes[10];
+	for (int part = 0; part < 10; ++part) {
+		uint16 ptrsId = 0x3E80 + part;
+		res.setupPtrs(ptrsId);
+		Decoder dec;
+		dec.setup(res._segCode, res._segCodeSize, ptrsId);
+		sizes[part] = res._segCodeSize;
+		checksums[part] = hash32(res._segCode, res._segCodeSize);
+		debug(DBG_INFO, "Part 0x%X size=0x%X checksum=0x%08X ops=%d", ptrsId, sizes[part], (unsigned int)checksums[part], dec._numOps);
+		emitPart(fp, &dec);
+	}
+	fprintf(fp, "const AotPart g_aotParts[] = {\n");
+	for (int part = 0; part < 10; ++part) {
+		fprintf(fp, "\t{ 0x%04X, 0x%04X, 0x%08X, aot_%04X },\n", 0x3E80 + part, sizes[part], (unsigned int)checksums[part], 0x3E80 + part);
+	}
+	fprintf(fp, "\t{ 0, 0, 0, 0 }\n");
+	fprintf(fp, "};\n");
+	fclose(fp);
+	res.freeMemBlock();
+	return 0;
+}
@@ -0,0 +1,242 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "codecache.h"
+#include "decoder.h"
+#include "file.h"
+#include "peephole.h"
+
+
+CodeCache::CodeCache()
+	: _dir(0), _checksum(0), _segSize(0), _map(0), _mapSize(0), _numPending(0) {
+}
+
+CodeCache::~CodeCache() {
+	close();
+}
+
+void CodeCache::open(const uint8 *seg, uint16 segSize) {
+	if (!_dir) {
+		return;
+	}
+	uint32 checksum = hash32(seg, segSize);
+	if (checksum == _checksum && segSize == _segSize) {
+		return;
+	}
+	close();
+	_checksum = checksum;
+	_segSize = segSize;
+	map();
+}
+
+void CodeCache::close() {
+	for (int i = 0; i < _numPending; ++i) {
+		free(_pending[i].data);
+	}
+	_numPending = 0;
+	unmap();
+	_checksum = 0;
+	_segSize = 0;
+}
+
+const uint8 *CodeCache::find(uint32 tag, uint32 *size) const {
+	for (int i = 0; i < _numPending; ++i) {
+		if (_pending[i].tag == tag) {
+			*size = _pending[i].size;
+			return _pending[i].data;
+		}
+	}
+	if (_map) {
+		const Header *hdr = (const Header *)_map;
+		for (int i = 0; i < hdr->numSections; ++i) {
+			if (hdr->sections[i].tag == tag) {
+				*size = hdr->sections[i].size;
+				return _map + hdr->sections[i].offset;
+			}
+		}
+	}
+	return 0;
+}
+
+void CodeCache::add(uint32 tag, const void *data, uint32 size) {
+	if (!_dir || _segSize == 0 || size == 0 || _numPending == MAX_SECTIONS) {
+		return;
+	}
+	PendingSection *ps = &_pending[_numPending];
+	ps->data = (uint8 *)malloc(size);
+	if (!ps->data) {
+		warning("CodeCache::add() unable to allocate %lu bytes", size);
+		return;
+	}
+	memcpy(ps->data, data, size);
+	ps->tag = tag;
+	ps->size = size;
+	++_numPending;
+}
+
+void CodeCache::flush() {
+	if (_numPending == 0) {
+		return;
+	}
+	// keep the sections already on disk which have not been replaced
+	Header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.id = 'AWCC';
+	hdr.version = CUR_VER;
+	hdr.checksum = _checksum;
+	hdr.config = getConfig();
+	hdr.segSize = _segSize;
+	hdr.layout = getLayout();
+	const uint8 *data[MAX_SECTIONS];
+	for (int i = 0; i < _numPending; ++i) {
+		hdr.sections[i].tag = _pending[i].tag;
+		hdr.sections[i].size = _pending[i].size;
+		hdr.sections[i].hash = hash32(_pending[i].data, _pending[i].size);
+		data[i] = _pending[i].data;
+	}
+	hdr.numSections = _numPending;
+	if (_map) {
+		const Header *mapHdr = (const Header *)_map;
+		for (int i = 0; i < mapHdr->numSections && hdr.numSections < MAX_SECTIONS; ++i) {
+			const Section *s = &mapHdr->sections[i];
+			int j = 0;
+			while (j < _numPending && _pending[j].tag != s->tag) {
+				++j;
+			}
+			if (j == _numPending) {
+				hdr.sections[hdr.numSections] = *s;
+				data[hdr.numSections] = _map + s->offset;
+				++hdr.numSections;
+			}
+		}
+	}
+	uint32 offset = sizeof(Header);
+	for (int i = 0; i < hdr.numSections; ++i) {
+		offset = (offset + 7) & ~7;
+		hdr.sections[i].offset = offset;
+		offset += hdr.sections[i].size;
+	}
+	// concurrent processes write to their own file, the rename is atomic
+	char cacheName[64];
+	makeFileName(cacheName);
+	char tmpName[80];
+	sprintf(tmpName, "%s.%d", cacheName, (int)getpid());
+	File f;
+	if (!f.open(tmpName, _dir, "wb")) {
+		warning("Unable to write cache file '%s'", tmpName);
+	} else {
+		f.write(&hdr, sizeof(hdr));
+		uint32 pos = sizeof(Header);
+		for (int i = 0; i < hdr.numSections; ++i) {
+			static uint8 padding[8];
+			f.write(padding, hdr.sections[i].offset - pos);
+			f.write((void *)data[i], hdr.sections[i].size);
+			pos = hdr.sections[i].offset + hdr.sections[i].size;
+		}
+		bool ioErr = f.ioErr();
+		f.close();
+		char tmpPath[512], cachePath[512];
+		sprintf(tmpPath, "%s/%s", _dir, tmpName);
+		sprintf(cachePath, "%s/%s", _dir, cacheName);
+		if (ioErr || rename(tmpPath, cachePath) != 0) {
+			warning("I/O error when writing cache file '%s'", cacheName);
+			unlink(tmpPath);
+		} else {
+			debug(DBG_INFO, "CodeCache::flush() wrote %d sections to '%s'", hdr.numSections, cacheName);
+		}
+	}
+	for (int i = 0; i < _numPending; ++i) {
+		free(_pending[i].data);
+	}
+	_numPending = 0;
+	unmap();
+	map();
+}
+
+void CodeCache::map() {
+	char name[64];
+	makeFileName(name);
+	char path[512];
+	sprintf(path, "%s/%s", _dir, name);
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Header)) {
+		void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			_map = (uint8 *)p;
+			_mapSize = st.st_size;
+		}
+	}
+	::close(fd);
+	if (_map) {
+		const Header *hdr = (const Header *)_map;
+		bool valid = hdr->id == 'AWCC' && hdr->version == CUR_VER && hdr->checksum == _checksum &&
+			hdr->config == getConfig() && hdr->segSize == _segSize && hdr->layout == getLayout() && hdr->numSections <= MAX_SECTIONS;
+		for (int i = 0; valid && i < hdr->numSections; ++i) {
+			const Section *s = &hdr->sections[i];
+			valid = s->offset <= _mapSize && s->size <= _mapSize - s->offset && hash32(_map + s->offset, s->size) == s->hash;
+		}
+		if (!valid) {
+			debug(DBG_INFO, "CodeCache::map() ignoring stale cache file '%s'", name);
+			unmap();
+		}
+	}
+}
+
+void CodeCache::unmap() {
+	if (_map) {
+		munmap(_map, _mapSize);
+		_map = 0;
+		_mapSize = 0;
+	}
+}
+
+uint16 CodeCache::getLayout() {
+	return sizeof(DecodedOp) | (sizeof(FusedOp) << 8);
+}
+
+// the opcodes left to the interpreter and the script executors change the
+// cached sections, the caches of the other builds are ignored
+uint32 CodeCache::getConfig() {
+	uint32 flags = 0;
+#ifdef BYPASS_PROTECTION
+	flags |= 1 << 0;
+#endif
+#ifdef USE_SCRIPT_DECODER
+	flags |= 1 << 1;
+#endif
+#ifdef USE_SCRIPT_JIT
+	flags |= 1 << 2;
+#endif
+	uint32 count = 0;
+	while (Decoder::_interpretedOps[count].ptrsId != 0) {
+		++count;
+	}
+	return hash32((const uint8 *)Decoder::_interpretedOps, count * sizeof(Decoder::InterpretedOp)) ^ flags;
+}
+
+void CodeCache::makeFileName(char *buf) const {
+	sprintf(buf, "raw-%08lx-%08lx.cache", _checksum, getConfig());
+}
@@ -0,0 +1,81 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __CODECACHE_H__
+#define __CODECACHE_H__
+
+#include "intern.h"
+
+// translation and analysis results of a code segment, written to
+// <cachepath>/raw-<checksum>-<config>.cache and mapped back by the next runs
+struct CodeCache {
+	enum {
+		CUR_VER = 3, // bump when the layout or the meaning of a cached section changes
+		MAX_SECTIONS = 4
+	};
+
+	struct Section {
+		uint32 tag;
+		uint32 offset;
+		uint32 size;
+		uint32 hash; // hash32() of the data, a damaged section drops the file
+	};
+
+	struct Header {
+		uint32 id;       // 'AWCC', native byte order
+		uint16 version;
+		uint16 numSections;
+		uint32 checksum; // hash32() of the code segment
+		uint32 config;   // build options the sections depend on
+		uint16 segSize;
+		uint16 layout;   // size of the cached structures
+		Section sections[MAX_SECTIONS];
+	};
+
+	struct PendingSection {
+		uint32 tag;
+		uint32 size;
+		uint8 *data;
+	};
+
+	const char *_dir;
+	uint32 _checksum;
+	uint16 _segSize;
+	uint8 *_map;
+	uint32 _mapSize;
+	PendingSection _pending[MAX_SECTIONS];
+	uint16 _numPending;
+
+	CodeCache();
+	~CodeCache();
+
+	void setDir(const char *dir) { _dir = dir; }
+	void open(const uint8 *seg, uint16 segSize);
+	void close();
+	const uint8 *find(uint32 tag, uint32 *size) const;
+	void add(uint32 tag, const void *data, uint32 size);
+	void flush();
+
+	void map();
+	void unmap();
+	static uint16 getLayout();
+	static uint32 getConfig();
+	void makeFileName(char *buf) const;
+};
+
+#endif
@@ -0,0 +1,422 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "decoder.h"
+
+
+static bool hasTarget(uint8 opcode) {
+	switch (opcode) {
+	case 0x04: // op_call
+	case 0x07: // op_jmp
+	case 0x09: // op_jnz
+	case 0x0A: // op_condJmp
+	case Decoder::DOP_GOTO:
+		return true;
+	}
+	return false;
+}
+
+// the ops executed next by Logic::executeDecoded() at the following index
+static bool fallsThrough(uint8 opcode) {
+	switch (opcode) {
+	case 0x00: // op_movConst
+	case 0x01: // op_mov
+	case 0x02: // op_add
+	case 0x03: // op_addConst
+	case 0x08: // op_setScriptSlot
+	case 0x09: // op_jnz
+	case 0x0A: // op_condJmp
+	case 0x13: // op_sub
+	case 0x14: // op_and
+	case 0x15: // op_or
+	case 0x16: // op_shl
+	case 0x17: // op_shr
+	case Decoder::DOP_VIDEO_80:
+	case Decoder::DOP_VIDEO_40:
+		return true;
+	}
+	return false;
+}
+
+// checks a cached op as decodeOp() and decodeRun() would have produced it
+static bool isValidOp(const DecodedOp *ops, uint32 numOps, uint32 i, uint16 segSize) {
+	const DecodedOp *op = &ops[i];
+	if (op->pos >= segSize) {
+		// the branches out of the segment are left to the interpreter
+		return op->opcode == Decoder::DOP_INTERPRET && op->next == op->pos;
+	}
+	if (op->next > segSize) {
+		return false;
+	}
+	if (hasTarget(op->opcode) && (op->target >= numOps || (op->opcode == Decoder::DOP_GOTO && ops[op->target].pos != op->pos))) {
+		return false;
+	}
+	if (fallsThrough(op->opcode) && (i + 1 >= numOps || ops[i + 1].pos != op->next)) {
+		return false;
+	}
+	switch (op->opcode) {
+	case 0x00: // op_movConst
+	case 0x03: // op_addConst
+	case 0x09: // op_jnz
+	case 0x14: // op_and
+	case 0x15: // op_or
+	case 0x16: // op_shl
+	case 0x17: // op_shr
+		return op->args[0] < 0x100;
+	case 0x01: // op_mov
+	case 0x02: // op_add
+	case 0x13: // op_sub
+		return op->args[0] < 0x100 && op->args[1] < 0x100;
+	case 0x0A: // op_condJmp
+		return (op->flags & Decoder::DF_COND_MASK) <= 5 && op->args[0] < 0x100 &&
+			(!(op->flags & Decoder::DF_COND_VAR) || op->args[1] < 0x100);
+	case Decoder::DOP_VIDEO_40:
+		return (!(op->flags & Decoder::DF_X_VAR) || op->args[1] < 0x100) &&
+			(!(op->flags & Decoder::DF_Y_VAR) || op->args[2] < 0x100) &&
+			(!(op->flags & Decoder::DF_ZOOM_VAR) || op->args[3] < 0x100);
+	case 0x04: // op_call
+	case 0x05: // op_ret
+	case 0x06: // op_break
+	case 0x07: // op_jmp
+	case 0x08: // op_setScriptSlot
+	case 0x11: // op_halt
+	case Decoder::DOP_VIDEO_80:
+	case Decoder::DOP_INTERPRET:
+	case Decoder::DOP_GOTO:
+		return true;
+	}
+	return false;
+}
+
+Decoder::Decoder()
+	: _seg(0), _segSize(0), _ptrsId(0), _ops(0), _numOps(0), _maxOps(0), _numBound(0), _workSize(0) {
+	_offsetMap = (uint16 *)malloc(0x10000 * sizeof(uint16));
+	_workList = (uint16 *)malloc(0x10000 * sizeof(uint16));
+	if (!_offsetMap || !_workList) {
+		error("Decoder::Decoder() unable to allocate offset map");
+	}
+	memset(_offsetMap, 0xFF, 0x10000 * sizeof(uint16));
+}
+
+Decoder::~Decoder() {
+	free(_ops);
+	free(_workList);
+	free(_offsetMap);
+}
+
+void Decoder::setup(const uint8 *seg, uint16 segSize, uint16 ptrsId) {
+	debug(DBG_LOGIC, "Decoder::setup() ptrsId=0x%X size=0x%X", ptrsId, segSize);
+	allocOps(seg, segSize, ptrsId);
+	decode(0);
+	debug(DBG_LOGIC, "Decoder::setup() decoded %d ops", _numOps);
+}
+
+// reuses the ops of a previous setup() on the same segment, see CodeCache
+bool Decoder::restore(const uint8 *seg, uint16 segSize, uint16 ptrsId, const uint8 *data, uint32 size) {
+	allocOps(seg, segSize, ptrsId);
+	uint32 numOps = size / sizeof(DecodedOp);
+	if (numOps == 0 || numOps > _maxOps || size != numOps * sizeof(DecodedOp)) {
+		return false;
+	}
+	// a truncated or corrupted file must not dispatch out of the ops nor
+	// access out of the segment and the variables
+	const DecodedOp *ops = (const DecodedOp *)data;
+	for (uint32 i = 0; i < numOps; ++i) {
+		if (!isValidOp(ops, numOps, i, segSize)) {
+			warning("Decoder::restore() ptrsId=0x%X invalid op %d", ptrsId, i);
+			return false;
+		}
+	}
+	memcpy(_ops, data, size);
+	_numOps = numOps;
+	for (uint16 i = 0; i < _numOps; ++i) {
+		DecodedOp *op = &_ops[i];
+		op->handler = 0;
+		if (op->opcode != DOP_GOTO) {
+			_offsetMap[op->pos] = i;
+		}
+	}
+	debug(DBG_LOGIC, "Decoder::restore() ptrsId=0x%X restored %d ops", ptrsId, _numOps);
+	return true;
+}
+
+void Decoder::allocOps(const uint8 *seg, uint16 segSize, uint16 ptrsId) {
+	_seg = seg;
+	_segSize = segSize;
+	_ptrsId = ptrsId;
+	// every decoded offset produces at most one op, plus one link per run
+	uint32 maxOps = segSize * 2 + 16;
+	_maxOps = (maxOps < NO_INDEX) ? maxOps : NO_INDEX - 1;
+	free(_ops);
+	_ops = (DecodedOp *)malloc(_maxOps * sizeof(DecodedOp));
+	if (!_ops) {
+		error("Decoder::allocOps() unable to allocate %d ops", _maxOps);
+	}
+	invalidate();
+}
+
+void Decoder::invalidate() {
+	_numOps = 0;
+	_numBound = 0;
+	_workSize = 0;
+	memset(_offsetMap, 0xFF, 0x10000 * sizeof(uint16));
+}
+
+uint16 Decoder::decode(uint16 pos) {
+	uint16 first = _numOps;
+	decodeRun(pos);
+	for (uint16 i = first; i < _numOps; ++i) {
+		while (_workSize != 0) {
+			uint16 p = _workList[--_workSize];
+			if (_offsetMap[p] == NO_INDEX) {
+				decodeRun(p);
+			}
+		}
+		DecodedOp *op = &_ops[i];
+		if (hasTarget(op->opcode)) {
+			uint16 t = op->target;
+			if (_offsetMap[t] == NO_INDEX) {
+				decodeRun(t);
+			}
+			op->target = _offsetMap[t];
+		}
+	}
+	return _offsetMap[pos];
+}
+
+void Decoder::decodeRun(uint16 pos) {
+	while (1) {
+		if (_offsetMap[pos] != NO_INDEX) {
+			DecodedOp *op = allocOp();
+			op->opcode = DOP_GOTO;
+			op->pos = op->next = op->target = pos;
+			break;
+		}
+		DecodedOp *op = allocOp();
+		_offsetMap[pos] = op - _ops;
+		if (!decodeOp(pos, op)) {
+			break;
+		}
+		pos = op->next;
+	}
+}
+
+// returns 0 for an invalid opcode or a truncated instruction
+uint16 Decoder::opLength(const uint8 *seg, uint16 segSize, uint16 pos) {
+	if (pos >= segSize) {
+		return 0;
+	}
+	const uint8 *p = seg + pos;
+	uint8 opcode = p[0];
+	uint32 len = 0;
+	if (opcode & 0x80) {
+		len = 4;
+	} else if (opcode & 0x40) {
+		len = 3;
+		len += (!(opcode & 0x20) && !(opcode & 0x10)) ? 2 : 1;
+		len += (!(opcode & 8) && !(opcode & 4)) ? 2 : 1;
+		if ((opcode & 3) == 1 || (opcode & 3) == 2) {
+			++len;
+		}
+	} else {
+		static const uint8 opLen[] = {
+			4, 3, 3, 4, 3, 1, 1, 3, 4, 4, 6, 3, 4, 2, 3, 3,
+			2, 1, 6, 3, 4, 4, 4, 4, 6, 3, 6
+		};
+		if (opcode < ARRAYSIZE(opLen)) {
+			len = opLen[opcode];
+			if (opcode == 0x0A && pos + 1 < segSize && (p[1] & 0xC0) == 0x40) {
+				++len;
+			} else if (opcode == 0x0C && pos + 2 < segSize && (int8)((p[2] & 0x3F) - p[1]) < 0) {
+				--len;
+			}
+		}
+	}
+	if (pos + len > segSize) {
+		return 0;
+	}
+	return len;
+}
+
+bool Decoder::decodeOp(uint16 pos, DecodedOp *op) {
+	op->handler = 0;
+	op->opcode = DOP_INTERPRET;
+	op->flags = 0;
+	memset(op->args, 0, sizeof(op->args));
+	op->pos = op->next = pos;
+	op->target = 0;
+	if (pos >= _segSize) {
+		return false;
+	}
+	const uint8 *p = _seg + pos;
+	uint8 opcode = p[0];
+	uint16 len = opLength(_seg, _segSize, pos);
+	op->next = pos + len;
+	if (len == 0) {
+		// invalid opcode or truncated instruction, leave it to the interpreter
+		return false;
+	}
+	if (isInterpreted(_ptrsId, pos)) {
+		if (opcode == 0x0A) {
+			pushTarget(READ_BE_UINT16(p + len - 2));
+		}
+		return true;
+	}
+	if (opcode & 0x80) {
+		int16 x = p[2];
+		int16 y = p[3];
+		int16 h = y - 199;
+		if (h > 0) {
+			y = 199;
+			x += h;
+		}
+		op->opcode = DOP_VIDEO_80;
+		op->args[0] = ((opcode << 8) | p[1]) * 2;
+		op->args[1] = x;
+		op->args[2] = y;
+		return true;
+	}
+	if (opcode & 0x40) {
+		op->opcode = DOP_VIDEO_40;
+		op->args[0] = READ_BE_UINT16(p + 1) * 2;
+		p += 3;
+		int16 x = *p++;
+		if (!(opcode & 0x20)) {
+			if (!(opcode & 0x10)) {
+				x = (x << 8) | *p++;
+			} else {
+				op->flags |= DF_X_VAR;
+			}
+		} else {
+			if (opcode & 0x10) {
+				x += 0x100;
+			}
+		}
+		op->args[1] = x;
+		int16 y = *p++;
+		if (!(opcode & 8)) {
+			if (!(opcode & 4)) {
+				y = (y << 8) | *p++;
+			} else {
+				op->flags |= DF_Y_VAR;
+			}
+		}
+		op->args[2] = y;
+		uint16 zoom = 0x40;
+		if (!(opcode & 2)) {
+			if (opcode & 1) {
+				zoom = *p;
+				op->flags |= DF_ZOOM_VAR;
+			}
+		} else {
+			if (opcode & 1) {
+				op->flags |= DF_SEG_VIDEO2;
+			} else {
+				zoom = *p;
+			}
+		}
+		op->args[3] = zoom;
+		return true;
+	}
+	op->opcode = opcode;
+	switch (opcode) {
+	case 0x00: // op_movConst
+	case 0x03: // op_addConst
+	case 0x14: // op_and
+	case 0x15: // op_or
+	case 0x16: // op_shl
+	case 0x17: // op_shr
+		op->args[0] = p[1];
+		op->args[1] = READ_BE_UINT16(p + 2);
+		break;
+	case 0x01: // op_mov
+	case 0x02: // op_add
+	case 0x13: // op_sub
+		op->args[0] = p[1];
+		op->args[1] = p[2];
+		break;
+	case 0x04: // op_call
+		op->target = READ_BE_UINT16(p + 1);
+		pushTarget(op->target);
+		break;
+	case 0x05: // op_ret
+	case 0x11: // op_halt
+		return false;
+	case 0x06: // op_break
+		break;
+	case 0x07: // op_jmp
+		op->target = READ_BE_UINT16(p + 1);
+		pushTarget(op->target);
+		return false;
+	case 0x08: // op_setScriptSlot
+		op->args[0] = p[1];
+		op->args[1] = READ_BE_UINT16(p + 2);
+		pushTarget(op->args[1]);
+		break;
+	case 0x09: // op_jnz
+		op->args[0] = p[1];
+		op->target = READ_BE_UINT16(p + 2);
+		pushTarget(op->target);
+		break;
+	case 0x0A: // op_condJmp
+		if ((p[1] & 7) > 5) {
+			op->opcode = DOP_INTERPRET;
+			break;
+		}
+		op->flags = p[1] & DF_COND_MASK;
+		op->args[0] = p[2];
+		if (p[1] & 0x80) {
+			op->flags |= DF_COND_VAR;
+			op->args[1] = p[3];
+		} else if (p[1] & 0x40) {
+			op->args[1] = (int16)(p[3] * 256 + p[4]);
+		} else {
+			op->args[1] = p[3];
+		}
+		op->target = READ_BE_UINT16(p + len - 2);
+		pushTarget(op->target);
+		break;
+	default:
+		// rare opcodes with side effects go through the interpreter
+		op->opcode = DOP_INTERPRET;
+		break;
+	}
+	return true;
+}
+
+bool Decoder::isInterpreted(uint16 ptrsId, uint16 pos) {
+	for (const InterpretedOp *io = _interpretedOps; io->ptrsId != 0; ++io) {
+		if (io->ptrsId == ptrsId && io->pos == pos) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Decoder::pushTarget(uint16 pos) {
+	if (pos < _segSize && _offsetMap[pos] == NO_INDEX && _workSize < 0xFFFF) {
+		_workList[_workSize++] = pos;
+	}
+}
+
+DecodedOp *Decoder::allocOp() {
+	if (_numOps >= _maxOps) {
+		error("Decoder::allocOp() ec=0x%X too many ops", 0xFFF);
+	}
+	return &_ops[_numOps++];
+}
@@ -0,0 +1,118 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __DECODER_H__
+#define __DECODER_H__
+
+#include "intern.h"
+
+struct DecodedOp {
+	const void *handler; // bound by Logic::executeDecoded()
+	uint8 opcode;        // Decoder::DecodedOpcode
+	uint8 flags;
+	uint16 args[4];
+	uint16 pos;          // bytecode offset of the instruction
+	uint16 next;         // bytecode offset following the instruction
+	uint16 target;       // index of the branch target
+};
+
+struct Decoder {
+	enum DecodedOpcode {
+		// 0x00-0x1A are the bytecode opcodes
+		DOP_VIDEO_80   = 0x1B,
+		DOP_VIDEO_40   = 0x1C,
+		DOP_INTERPRET  = 0x1D, // executed by Logic::executeOpcode()
+		DOP_GOTO       = 0x1E, // links a decoded run to an already decoded offset
+		DOP_COUNT
+	};
+
+	enum {
+		// DOP_VIDEO_40
+		DF_X_VAR      = 1 << 0,
+		DF_Y_VAR      = 1 << 1,
+		DF_ZOOM_VAR   = 1 << 2,
+		DF_SEG_VIDEO2 = 1 << 3,
+		// op_condJmp
+		DF_COND_MASK  = 7,
+		DF_COND_VAR   = 1 << 7
+	};
+
+	enum {
+		NO_INDEX = 0xFFFF
+	};
+
+	struct InterpretedOp {
+		uint16 ptrsId;
+		uint16 pos;
+	};
+
+	static const InterpretedOp _interpretedOps[];
+
+	const uint8 *_seg;
+	uint16 _segSize;
+	uint16 _ptrsId;
+	DecodedOp *_ops;
+	uint16 _numOps, _maxOps;
+	uint16 _numBound;
+	uint16 *_offsetMap;
+	uint16 *_workList;
+	uint16 _workSize;
+
+	Decoder();
+	~Decoder();
+
+	void setup(const uint8 *seg, uint16 segSize, uint16 ptrsId);
+	bool restore(const uint8 *seg, uint16 segSize, uint16 ptrsId, const uint8 *data, uint32 size);
+	void allocOps(const uint8 *seg, uint16 segSize, uint16 ptrsId);
+	void invalidate();
+	uint16 lookup(uint16 pos) {
+		uint16 i = _offsetMap[pos];
+		if (i == NO_INDEX) {
+			i = decode(pos);
+		}
+		return i;
+	}
+
+	uint16 decode(uint16 pos);
+	void decodeRun(uint16 pos);
+	bool decodeOp(uint16 pos, DecodedOp *op);
+	static uint16 opLength(const uint8 *seg, uint16 segSize, uint16 pos);
+	static bool isInterpreted(uint16 ptrsId, uint16 pos);
+	// op_condJmp comparison of the variable b with a
+	static bool evalCond(uint8 cond, int16 b, int16 a) {
+		switch (cond) {
+		case 0:	// jz
+			return (b == a);
+		case 1: // jnz
+			return (b != a);
+		case 2: // jg
+			return (b > a);
+		case 3: // jge
+			return (b >= a);
+		case 4: // jl
+			return (b < a);
+		case 5: // jle
+			return (b <= a);
+		}
+		return false;
+	}
+	void pushTarget(uint16 pos);
+	DecodedOp *allocOp();
+};
+
+#endif
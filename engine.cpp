@@ -22,13 +22,18 @@
 #include "systemstub.h"
 
 
-Engine::Engine(SystemStub *stub, const char *dataDir, const char *saveDir)
+EngineOptions::EngineOptions()
+	: cacheDir(0), numThreads(1), spanCacheSize(0), drawLists(false),
+	renderW(Video::VID_PAGE_W), renderH(Video::VID_PAGE_H), drawThreads(1), pageCacheSize(0), renderTrace(0) {
+}
+
+Engine::Engine(SystemStub *stub, const char *dataDir, const char *saveDir, const EngineOptions &opts)
 	: _stub(stub), _log(&_mix, &_res, &_ply, &_vid, _stub), _mix(_stub), _res(&_vid, dataDir), 
-	_ply(&_mix, &_res, _stub), _vid(&_res, stub), _dataDir(dataDir), _saveDir(saveDir), _stateSlot(0) {
+	_ply(&_mix, &_res, _stub), _vid(&_res, stub), _dataDir(dataDir), _saveDir(saveDir), _stateSlot(0), _opts(opts) {
 }
 
 void Engine::run() {
-	_stub->init("Out Of This World");
+	_stub->init("Out Of This World", _opts.renderW, _opts.renderH);
 	setup();
 	_log.restartAt(0x3E80); // demo starts at 0x3E81
 	while (!_stub->_pi.quit) {
@@ -42,18 +47,40 @@ void Engine::run() {
 }
 
 void Engine::setup() {
-	_vid.init();
+#ifdef USE_TRACE
+	Trace::start(_stub);
+#endif
+	_vid.init(_opts.renderW, _opts.renderH);
+	_vid._spanCache.init(_opts.spanCacheSize);
+	_vid._pageCache.init(_opts.pageCacheSize, _vid._pageSize);
+	_vid.initWorkers(_opts.drawThreads);
+	// the bands are drawn when resolving the lists
+	_vid._deferred = _opts.drawLists || _opts.drawThreads > 1;
+	if (_opts.renderTrace) {
+		_vid.startTrace(_opts.renderTrace, _saveDir);
+	}
 	_res.allocMemBlock();
 	_res.readEntries();
+	_res._cache.setDir(_opts.cacheDir);
 	_log.init();
+	_log.initWorkers(_opts.numThreads);
 	_mix.init();
 	_ply.init();
 }
 
 void Engine::finish() {
+#ifdef USE_PROFILER
+	_log._prof.dump("raw_profile.csv", _saveDir);
+#endif
+	_log.freeWorkers();
+	_vid.freeWorkers();
+	_vid.stopTrace();
 	_ply.free();
 	_mix.free();
 	_res.freeMemBlock();
+#ifdef USE_TRACE
+	Trace::stop();
+#endif
 }
 
 void Engine::processInput() {
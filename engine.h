@@ -28,6 +28,20 @@
 
 struct SystemStub;
 
+// the command line settings, main.cpp fills them
+struct EngineOptions {
+	const char *cacheDir; // translated scripts, 0 to not cache them
+	int numThreads; // running the scripts
+	uint32 spanCacheSize;
+	bool drawLists;
+	uint16 renderW, renderH;
+	int drawThreads;
+	uint32 pageCacheSize;
+	const char *renderTrace; // file in the save directory, 0 to not record
+
+	EngineOptions();
+};
+
 struct Engine {
 	enum {
 		MAX_SAVE_SLOTS = 100
@@ -41,8 +55,9 @@ struct Engine {
 	Video _vid;
 	const char *_dataDir, *_saveDir;
 	uint8 _stateSlot;
+	EngineOptions _opts;
 
-	Engine(SystemStub *stub, const char *dataDir, const char *saveDir);
+	Engine(SystemStub *stub, const char *dataDir, const char *saveDir, const EngineOptions &opts);
 
 	void run();
 	void setup();
@@ -162,7 +162,7 @@ uint16 File::readUint16BE() {
 uint32 File::readUint32BE() {
 	uint16 hi = readUint16BE();
 	uint16 lo = readUint16BE();
-	return (hi << 16) | lo;
+	return ((uint32)hi << 16) | lo;
 }
 
 void File::write(void *ptr, uint32 size) {
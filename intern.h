@@ -60,4 +60,8 @@ struct Point {
 	Point(const Point &p) : x(p.x), y(p.y) {}
 };
 
+struct Rect {
+	uint16 x, y, w, h;
+};
+
 #endif
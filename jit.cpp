@@ -0,0 +1,256 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "jit.h"
+#include "decoder.h"
+
+#ifdef SCRIPT_JIT_ENABLED
+
+#include <sys/mman.h>
+
+// x86-64 condition codes, the short jcc opcode is 0x70 + cc
+enum {
+	CC_E  = 0x4,
+	CC_NE = 0x5,
+	CC_L  = 0xC,
+	CC_GE = 0xD,
+	CC_LE = 0xE,
+	CC_G  = 0xF
+};
+
+Jit::Jit()
+	: _dec(0), _hits(0), _blocks(0), _maxOps(0), _codeSize(0), _code(0), _numBlocks(0) {
+	_codeBuf = (uint8 *)mmap(0, CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (_codeBuf == MAP_FAILED) {
+		warning("Jit::Jit() unable to map code buffer");
+		_codeBuf = 0;
+	}
+}
+
+Jit::~Jit() {
+	free(_hits);
+	free(_blocks);
+	if (_codeBuf) {
+		munmap(_codeBuf, CODE_SIZE);
+	}
+}
+
+void Jit::setup(const Decoder *dec, int16 *vars, uint16 *stackCalls, uint8 *stackPtr) {
+	_dec = dec;
+	_state.vars = vars;
+	_state.stackCalls = stackCalls;
+	_state.stackPtr = stackPtr;
+	if (_maxOps != dec->_maxOps) {
+		_maxOps = dec->_maxOps;
+		free(_hits);
+		free(_blocks);
+		_hits = (uint16 *)malloc(_maxOps * sizeof(uint16));
+		_blocks = (NativeBlock *)malloc(_maxOps * sizeof(NativeBlock));
+	}
+	reset();
+}
+
+void Jit::reset() {
+	debug(DBG_LOGIC, "Jit::reset() blocks=%d code=%d", _numBlocks, _codeSize);
+	if (_hits) {
+		memset(_hits, 0, _maxOps * sizeof(uint16));
+	}
+	_codeSize = 0;
+	_numBlocks = 0;
+}
+
+bool Jit::compile(uint16 i) {
+	const DecodedOp *op = &_dec->_ops[i];
+	switch (op->opcode) {
+	case 0x00: case 0x01: case 0x02: case 0x03:
+	case 0x04: case 0x05: case 0x09: case 0x0A:
+	case 0x13: case 0x14: case 0x15: case 0x16: case 0x17:
+		break;
+	default:
+		return false;
+	}
+	// worst case op is the call sequence, plus the final exit
+	if (!_codeBuf || _codeSize + MAX_BLOCK_OPS * 48 + 16 > CODE_SIZE) {
+		return false;
+	}
+	if (mprotect(_codeBuf, CODE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+		return false;
+	}
+	uint8 *start = _codeBuf + _codeSize;
+	_code = start;
+	_leader = i;
+	// mov rsi, [rdi] (JitState::vars)
+	emitByte(0x48); emitByte(0x8B); emitByte(0x37);
+	_loopStart = _code;
+	bool stop = false;
+	for (int n = 0; !stop; ++n, ++i) {
+		if (n == MAX_BLOCK_OPS || !compileOp(i, stop)) {
+			emitExit(i);
+			break;
+		}
+	}
+	_codeSize = _code - _codeBuf;
+	mprotect(_codeBuf, CODE_SIZE, PROT_READ | PROT_EXEC);
+	_blocks[_leader] = (NativeBlock)start;
+	++_numBlocks;
+	debug(DBG_LOGIC, "Jit::compile() leader=0x%X pos=0x%X size=%d", _leader, _dec->_ops[_leader].pos, _code - start);
+	return true;
+}
+
+bool Jit::compileOp(uint16 i, bool &stop) {
+	const DecodedOp *op = &_dec->_ops[i];
+	switch (op->opcode) {
+	case 0x00: // op_movConst, mov word [rsi+d], imm16
+		emitByte(0x66); emitByte(0xC7); emitVar(0, op->args[0]); emitWord(op->args[1]);
+		break;
+	case 0x01: // op_mov, movzx eax, word [rsi+j] ; mov word [rsi+i], ax
+		emitByte(0x0F); emitByte(0xB7); emitVar(0, op->args[1]);
+		emitByte(0x66); emitByte(0x89); emitVar(0, op->args[0]);
+		break;
+	case 0x02: // op_add, add word [rsi+i], ax
+		emitByte(0x0F); emitByte(0xB7); emitVar(0, op->args[1]);
+		emitByte(0x66); emitByte(0x01); emitVar(0, op->args[0]);
+		break;
+	case 0x03: // op_addConst, add word [rsi+d], imm16
+		emitByte(0x66); emitByte(0x81); emitVar(0, op->args[0]); emitWord(op->args[1]);
+		break;
+	case 0x13: // op_sub, sub word [rsi+i], ax
+		emitByte(0x0F); emitByte(0xB7); emitVar(0, op->args[1]);
+		emitByte(0x66); emitByte(0x29); emitVar(0, op->args[0]);
+		break;
+	case 0x14: // op_and, and word [rsi+d], imm16
+		emitByte(0x66); emitByte(0x81); emitVar(4, op->args[0]); emitWord(op->args[1]);
+		break;
+	case 0x15: // op_or, or word [rsi+d], imm16
+		emitByte(0x66); emitByte(0x81); emitVar(1, op->args[0]); emitWord(op->args[1]);
+		break;
+	case 0x16: // op_shl
+	case 0x17: // op_shr
+		// the shift is done on the promoted int, the count is masked like 'shl eax, cl'
+		emitByte(0x0F); emitByte(0xB7); emitVar(0, op->args[0]);
+		emitByte(0xC1); emitByte(op->opcode == 0x16 ? 0xE0 : 0xE8); emitByte(op->args[1] & 31);
+		emitByte(0x66); emitByte(0x89); emitVar(0, op->args[0]);
+		break;
+	case 0x04: // op_call
+		// mov r8, [rdi+8] ; mov r9, [rdi+16] ; movzx eax, byte [r9] ; cmp al, 0xFF
+		emitByte(0x4C); emitByte(0x8B); emitByte(0x47); emitByte(0x08);
+		emitByte(0x4C); emitByte(0x8B); emitByte(0x4F); emitByte(0x10);
+		emitByte(0x41); emitByte(0x0F); emitByte(0xB6); emitByte(0x01);
+		emitByte(0x3C); emitByte(0xFF);
+		// jne +6 ; stack overflow is reported by the interpreter
+		emitByte(0x70 | CC_NE); emitByte(6);
+		emitExit(RET_INTERPRET | i);
+		// mov word [r8+rax*2], imm16 ; inc byte [r9]
+		emitByte(0x66); emitByte(0x41); emitByte(0xC7); emitByte(0x04); emitByte(0x40); emitWord(op->next);
+		emitByte(0x41); emitByte(0xFE); emitByte(0x01);
+		emitBranch(0, op->target);
+		stop = true;
+		break;
+	case 0x05: // op_ret
+		// mov r9, [rdi+16] ; movzx eax, byte [r9] ; test al, al
+		emitByte(0x4C); emitByte(0x8B); emitByte(0x4F); emitByte(0x10);
+		emitByte(0x41); emitByte(0x0F); emitByte(0xB6); emitByte(0x01);
+		emitByte(0x84); emitByte(0xC0);
+		// jne +6 ; stack underflow is reported by the interpreter
+		emitByte(0x70 | CC_NE); emitByte(6);
+		emitExit(RET_INTERPRET | i);
+		// dec al ; mov [r9], al ; mov r8, [rdi+8] ; movzx eax, word [r8+rax*2]
+		emitByte(0xFE); emitByte(0xC8);
+		emitByte(0x41); emitByte(0x88); emitByte(0x01);
+		emitByte(0x4C); emitByte(0x8B); emitByte(0x47); emitByte(0x08);
+		emitByte(0x41); emitByte(0x0F); emitByte(0xB7); emitByte(0x04); emitByte(0x40);
+		// or eax, RET_LOOKUP ; ret
+		emitByte(0x0D); emitLong(RET_LOOKUP);
+		emitByte(0xC3);
+		stop = true;
+		break;
+	case 0x07: // op_jmp
+	case Decoder::DOP_GOTO:
+		emitBranch(0, op->target);
+		stop = true;
+		break;
+	case 0x09: // op_jnz, sub word [rsi+d], 1
+		emitByte(0x66); emitByte(0x83); emitVar(5, op->args[0]); emitByte(1);
+		emitBranch(CC_NE, op->target);
+		break;
+	case 0x0A: { // op_condJmp
+			static const uint8 ccTable[] = { CC_E, CC_NE, CC_G, CC_GE, CC_L, CC_LE };
+			// movsx eax, word [rsi+b]
+			emitByte(0x0F); emitByte(0xBF); emitVar(0, op->args[0]);
+			if (op->flags & Decoder::DF_COND_VAR) {
+				// movsx ecx, word [rsi+a] ; cmp ax, cx
+				emitByte(0x0F); emitByte(0xBF); emitVar(1, op->args[1]);
+				emitByte(0x66); emitByte(0x39); emitByte(0xC8);
+			} else {
+				// cmp ax, imm16
+				emitByte(0x66); emitByte(0x3D); emitWord(op->args[1]);
+			}
+			emitBranch(ccTable[op->flags & Decoder::DF_COND_MASK], op->target);
+		}
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+void Jit::emitByte(uint8 b) {
+	*_code++ = b;
+}
+
+void Jit::emitWord(uint16 w) {
+	emitByte(w & 0xFF);
+	emitByte(w >> 8);
+}
+
+void Jit::emitLong(uint32 l) {
+	emitWord(l & 0xFFFF);
+	emitWord(l >> 16);
+}
+
+void Jit::emitVar(uint8 reg, uint16 var) {
+	// ModRM [rsi+disp32]
+	emitByte(0x86 | (reg << 3));
+	emitLong(var * 2);
+}
+
+void Jit::emitExit(uint32 ret) {
+	// mov eax, imm32 ; ret
+	emitByte(0xB8); emitLong(ret);
+	emitByte(0xC3);
+}
+
+void Jit::emitBranch(uint8 cc, uint16 target) {
+	if (target == _leader) {
+		// jmp/jcc rel32 back to the top of the block
+		if (cc == 0) {
+			emitByte(0xE9);
+		} else {
+			emitByte(0x0F); emitByte(0x80 | cc);
+		}
+		emitLong(_loopStart - (_code + 4));
+	} else {
+		if (cc != 0) {
+			// inverted jcc over the exit
+			emitByte(0x70 | (cc ^ 1)); emitByte(6);
+		}
+		emitExit(target);
+	}
+}
+
+#endif
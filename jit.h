@@ -0,0 +1,84 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "intern.h"
+
+#if defined(USE_SCRIPT_JIT) && defined(USE_SCRIPT_DECODER) && defined(__GNUC__) && defined(__x86_64__) && !defined(_WIN32)
+#define SCRIPT_JIT_ENABLED
+#endif
+
+struct Decoder;
+
+struct JitState {
+	int16 *vars;
+	uint16 *stackCalls;
+	uint8 *stackPtr;
+};
+
+struct Jit {
+	typedef uint32 (*NativeBlock)(JitState *st);
+
+	enum {
+		HOT_THRESHOLD = 64,
+		CODE_SIZE     = 256 * 1024,
+		MAX_BLOCK_OPS = 64
+	};
+
+	enum {
+		RET_LOOKUP    = 0x80000000, // resume at the bytecode offset in the low 16 bits
+		RET_INTERPRET = 0x40000000  // interpret the op at the index in the low 16 bits
+	};
+
+	JitState _state;
+	const Decoder *_dec;
+	uint16 *_hits;
+	NativeBlock *_blocks;
+	uint16 _maxOps;
+	uint8 *_codeBuf;
+	uint32 _codeSize;
+	uint8 *_code;
+	uint16 _leader;
+	uint8 *_loopStart;
+	uint32 _numBlocks;
+
+	Jit();
+	~Jit();
+
+	void setup(const Decoder *dec, int16 *vars, uint16 *stackCalls, uint8 *stackPtr);
+	void reset();
+	bool hit(uint16 i) {
+		return _hits && _hits[i] < HOT_THRESHOLD && ++_hits[i] == HOT_THRESHOLD;
+	}
+	bool compile(uint16 i);
+	uint32 run(uint16 i) {
+		return _blocks[i](&_state);
+	}
+
+	bool compileOp(uint16 i, bool &stop);
+	void emitByte(uint8 b);
+	void emitWord(uint16 w);
+	void emitLong(uint32 l);
+	void emitVar(uint8 reg, uint16 var);
+	void emitExit(uint32 ret);
+	void emitBranch(uint8 cc, uint16 target);
+};
+
+#endif
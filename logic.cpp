@@ -26,8 +26,21 @@
 #include "systemstub.h"
 
 
+static inline int bitScan(uint64 mask) {
+#if defined(__GNUC__)
+	return __builtin_ctzll(mask);
+#else
+	int i = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		++i;
+	}
+	return i;
+#endif
+}
+
 Logic::Logic(Mixer *mix, Resource *res, SfxPlayer *ply, Video *vid, SystemStub *stub)
-	: _mix(mix), _res(res), _ply(ply), _vid(vid), _stub(stub) {
+	: _mix(mix), _res(res), _ply(ply), _vid(vid), _stub(stub), _workers(stub), _deps(0) {
 }
 
 void Logic::init() {
@@ -35,6 +48,13 @@ void Logic::init() {
 	_scriptVars[0x54] = 0x81;
 	_scriptVars[VAR_RANDOM_SEED] = time(0);
 	_fastMode = false;
+	_readyMask = _pausedMask = _pendingMask = 0;
+	resetSpinWaits();
+	_codeSeg = 0;
+	_codeVerified = false;
+#ifdef USE_AOT_SCRIPTS
+	_aot = 0;
+#endif
 	_ply->_markVar = &_scriptVars[VAR_MUS_MARK];
 }
 
@@ -98,6 +118,16 @@ void Logic::op_ret() {
 	_scriptPtr.pc = _res->_segCode + _scriptStackCalls[sp];
 }
 
+void Logic::op_callUnchecked() {
+	uint16 off = _scriptPtr.fetchWord();
+	_scriptStackCalls[_stackPtr++] = _scriptPtr.pc - _res->_segCode;
+	_scriptPtr.pc = _res->_segCode + off;
+}
+
+void Logic::op_retUnchecked() {
+	_scriptPtr.pc = _res->_segCode + _scriptStackCalls[--_stackPtr];
+}
+
 void Logic::op_break() {
 	debug(DBG_LOGIC, "Logic::op_break()");
 	_scriptHalted = true;
@@ -113,7 +143,7 @@ void Logic::op_setScriptSlot() {
 	uint8 i = _scriptPtr.fetchByte();
 	uint16 n = _scriptPtr.fetchWord();
 	debug(DBG_LOGIC, "Logic::op_setScriptSlot(0x%X, 0x%X)", i, n);
-	_scriptSlotsPos[1][i] = n;
+	setScriptSlot(i, n);
 }
 
 void Logic::op_jnz() {
@@ -138,6 +168,7 @@ void Logic::op_condJmp() {
 		*(_scriptPtr.pc + 0x99) = 0x0D;
 		*(_scriptPtr.pc + 0x9A) = 0x5A;
 		warning("Logic::op_condJmp() bypassing protection");
+		invalidateCode();
 	}
 #endif
 	uint8 op = _scriptPtr.fetchByte();
@@ -152,31 +183,10 @@ void Logic::op_condJmp() {
 		a = c;
 	}
 	debug(DBG_LOGIC, "Logic::op_condJmp(%d, 0x%02X, 0x%02X)", op, b, a);
-	bool expr = false;
-	switch (op & 7) {
-	case 0:	// jz
-		expr = (b == a);
-		break;
-	case 1: // jnz
-		expr = (b != a);
-		break;
-	case 2: // jg
-		expr = (b > a);
-		break;
-	case 3: // jge
-		expr = (b >= a);
-		break;
-	case 4: // jl
-		expr = (b < a);
-		break;
-	case 5: // jle
-		expr = (b <= a);
-		break;
-	default:
+	if ((op & 7) > 5) {
 		warning("Logic::op_condJmp() invalid condition %d", (op & 7));
-		break;
 	}
-	if (expr) {
+	if (Decoder::evalCond(op & 7, b, a)) {
 		op_jmp();
 	} else {
 		_scriptPtr.fetchWord();
@@ -202,15 +212,14 @@ void Logic::op_resetScript() {
 
 	debug(DBG_LOGIC, "Logic::op_resetScript(%d, %d, %d)", j, i, a);
 
-	if (a == 2) {
-		uint16 *p = &_scriptSlotsPos[1][j];
-		while (n--) {
-			*p++ = 0xFFFE;
-		}
-	} else if (a < 2) {
-		uint8 *p = &_scriptPaused[1][j];
-		while (n--) {
-			*p++ = a;
+	if (a <= 2) {
+		for (; n-- && j < 0x40; ++j) {
+			if (a == 2) {
+				_scriptSlots[j].nextPos = 0xFFFE;
+			} else {
+				_scriptSlots[j].nextPaused = a;
+			}
+			_pendingMask |= (uint64)1 << j;
 		}
 	}
 }
@@ -342,9 +351,8 @@ void Logic::restartAt(uint16 ptrId) {
 	_mix->stopAll();
 	_scriptVars[0xE4] = 0x14;
 	_res->setupPtrs(ptrId);
-	memset((uint8 *)_scriptSlotsPos, 0xFF, sizeof(_scriptSlotsPos));
-	memset((uint8 *)_scriptPaused, 0, sizeof(_scriptPaused));
-	_scriptSlotsPos[0][0] = 0;	
+	resetSlots();
+	setupCode();
 }
 
 void Logic::setupScripts() {
@@ -352,102 +360,714 @@ void Logic::setupScripts() {
 		restartAt(_res->_newPtrsId);
 		_res->_newPtrsId = 0;
 	}
-	for (int i = 0; i < 0x40; ++i) {
-		_scriptPaused[0][i] = _scriptPaused[1][i];
-		uint16 n = _scriptSlotsPos[1][i];
+	while (_pendingMask != 0) {
+		int i = bitScan(_pendingMask);
+		_pendingMask &= _pendingMask - 1;
+		ScriptSlot *slot = &_scriptSlots[i];
+		slot->paused = slot->nextPaused;
+		uint16 n = slot->nextPos;
 		if (n != 0xFFFF) {
-			_scriptSlotsPos[0][i] = (n == 0xFFFE) ? 0xFFFF : n;
-			_scriptSlotsPos[1][i] = 0xFFFF;
+			slot->pos = (n == 0xFFFE) ? 0xFFFF : n;
+			slot->nextPos = 0xFFFF;
+		}
+		uint64 bit = (uint64)1 << i;
+		if (slot->paused != 0) {
+			_pausedMask |= bit;
+		} else {
+			_pausedMask &= ~bit;
+		}
+		if (slot->pos != 0xFFFF && slot->paused == 0) {
+			_readyMask |= bit;
+		} else {
+			_readyMask &= ~bit;
 		}
 	}
 }
 
 void Logic::runScripts() {
+	if (_codeSeg != _res->_segCode) {
+		setupCode();
+	}
+#ifdef USE_PROFILER
+	_prof.addFrame();
+#endif
+	// other slots only change on the next frame, the mask can be walked as is
+	uint64 ready = _readyMask;
+	while (ready != 0) {
+		if (_deps && runBatch(ready)) {
+			continue;
+		}
+		int i = bitScan(ready);
+		ready &= ready - 1;
+		ScriptSlot *slot = &_scriptSlots[i];
+		uint16 n = slot->pos;
+		if (!isSpinning(i, n)) {
+			_scriptPtr.pc = _res->_segCode + n;
+			_stackPtr = 0;
+			_scriptHalted = false;
+			debug(DBG_LOGIC, "Logic::runScripts() i=0x%02X n=0x%02X *p=0x%02X", i, n, *_scriptPtr.pc);
+#ifdef USE_PROFILER
+			_profInsns = 0;
+			uint64 t = Profiler::now();
+			executeScript();
+			_prof.addSlot(i, _profInsns, Profiler::now() - t);
+#else
+			executeScript();
+#endif
+			slot->pos = _scriptPtr.pc - _res->_segCode;
+			if (slot->pos == 0xFFFF) {
+				_readyMask &= ~((uint64)1 << i);
+			} else if (slot->pos == n) {
+				detectSpinWait(i, n);
+			}
+			debug(DBG_LOGIC, "Logic::runScripts() i=0x%02X pos=0x%X", i, slot->pos);
+		}
+		if (_stub->_pi.quit) {
+			break;
+		}
+	}
+}
+
+bool Logic::runBatch(uint64 &ready) {
+	if (_stub->_pi.quit) {
+		return false;
+	}
+	// gather the next slots touching disjoint variables and nothing else
+	uint8 reads[0x100 / 8];
+	uint8 writes[0x100 / 8];
+	memset(reads, 0, sizeof(reads));
+	memset(writes, 0, sizeof(writes));
+	int count = 0;
+	for (uint64 m = ready; m != 0; m &= m - 1) {
+		int i = bitScan(m);
+		uint16 pos = _scriptSlots[i].pos;
+		if (_spinWaits[i].pos == pos) {
+			break;
+		}
+		const ScriptDeps::Summary *s = _deps->lookup(pos);
+		if (!s || !s->pure || ScriptDeps::conflicts(s, reads, writes)) {
+			break;
+		}
+		ScriptDeps::merge(s, reads, writes);
+		_batchSlots[count] = i;
+		_batchContexts[count].pos = pos;
+		_batchContexts[count].stackPtr = 0;
+		++count;
+	}
+	if (count < 2) {
+		return false;
+	}
+	_workers.run(runBatchJob, this, count);
+	// commit in slot order, as the sequential loop would
+	for (int k = 0; k < count; ++k) {
+		int i = _batchSlots[k];
+		ScriptSlot *slot = &_scriptSlots[i];
+		uint16 n = slot->pos;
+		slot->pos = _batchContexts[k].pos;
+		if (slot->pos == 0xFFFF) {
+			_readyMask &= ~((uint64)1 << i);
+		} else if (slot->pos == n) {
+			detectSpinWait(i, n);
+		}
+		ready &= ~((uint64)1 << i);
+	}
+	return true;
+}
+
+void Logic::runBatchJob(void *param, int job) {
+	Logic *log = (Logic *)param;
+	log->_deps->execute(log->_scriptVars, &log->_batchContexts[job]);
+}
+
+void Logic::initWorkers(int numThreads) {
+#ifdef USE_PROFILER
+	// the batches run outside executeOpcode(), their opcodes and slots would not be attributed
+	if (numThreads > 1) {
+		warning("Logic::initWorkers() script threads disabled by USE_PROFILER");
+		numThreads = 1;
+	}
+#endif
+	if (numThreads > 1) {
+		_workers.init(numThreads - 1);
+		_deps = new ScriptDeps;
+		_codeSeg = 0;
+	}
+}
+
+void Logic::freeWorkers() {
+	if (_deps) {
+		_workers.free();
+		delete _deps;
+		_deps = 0;
+	}
+}
+
+void Logic::resetSpinWaits() {
 	for (int i = 0; i < 0x40; ++i) {
-		if (_scriptPaused[0][i] == 0) {
-			uint16 n = _scriptSlotsPos[0][i];
-			if (n != 0xFFFF) {
-				_scriptPtr.pc = _res->_segCode + n;
-				_stackPtr = 0;
-				_scriptHalted = false;
-				debug(DBG_LOGIC, "Logic::runScripts() i=0x%02X n=0x%02X *p=0x%02X", i, n, *_scriptPtr.pc);
-				executeScript();
-				_scriptSlotsPos[0][i] = _scriptPtr.pc - _res->_segCode;
-				debug(DBG_LOGIC, "Logic::runScripts() i=0x%02X pos=0x%X", i, _scriptSlotsPos[0][i]);
-				if (_stub->_pi.quit) {
-					break;
+		_spinWaits[i].pos = _spinWaits[i].failedPos = 0xFFFF;
+	}
+}
+
+bool Logic::isSpinning(uint8 i, uint16 pos) {
+	SpinWait *sw = &_spinWaits[i];
+	if (sw->pos != pos) {
+		return false;
+	}
+	for (int k = 0; k < sw->numVars; ++k) {
+		if (_scriptVars[sw->vars[k]] != sw->values[k]) {
+			sw->pos = 0xFFFF;
+			return false;
+		}
+	}
+	return true;
+}
+
+void Logic::detectSpinWait(uint8 i, uint16 pos) {
+	// The slot went through a whole frame back to its start offset. If the
+	// path only branches on variables and ends with op_break, running it
+	// again gives the same result until one of these variables changes.
+	SpinWait *sw = &_spinWaits[i];
+	sw->pos = 0xFFFF;
+	if (sw->failedPos == pos) {
+		return;
+	}
+	sw->numVars = 0;
+	const uint8 *seg = _res->_segCode;
+	uint16 pc = pos;
+	for (int step = 0; step < MAX_SPIN_STEPS && pc < _res->_segCodeSize; ++step) {
+		const uint8 *p = seg + pc;
+		if (p[0] == 0x06) { // op_break
+			if (pc + 1 == pos) {
+				sw->pos = pos;
+				for (int k = 0; k < sw->numVars; ++k) {
+					sw->values[k] = _scriptVars[sw->vars[k]];
+				}
+				return;
+			}
+			break;
+		} else if (p[0] == 0x07) { // op_jmp
+			pc = READ_BE_UINT16(p + 1);
+		} else if (p[0] == 0x0A) { // op_condJmp
+			if (Decoder::isInterpreted(_res->_curPtrsId, pc)) {
+				break;
+			}
+			uint8 op = p[1];
+			uint8 vars[2];
+			int numVars = 0;
+			vars[numVars++] = p[2];
+			int16 a = p[3];
+			uint16 len = 6;
+			if (op & 0x80) {
+				vars[numVars++] = p[3];
+				a = _scriptVars[p[3]];
+			} else if (op & 0x40) {
+				a = p[3] * 256 + p[4];
+				++len;
+			}
+			for (int v = 0; v < numVars; ++v) {
+				int k = 0;
+				while (k < sw->numVars && sw->vars[k] != vars[v]) {
+					++k;
 				}
+				if (k == sw->numVars) {
+					if (k == MAX_SPIN_VARS) {
+						sw->failedPos = pos;
+						return;
+					}
+					sw->vars[sw->numVars++] = vars[v];
+				}
+			}
+			if (Decoder::evalCond(op & 7, _scriptVars[p[2]], a)) {
+				pc = READ_BE_UINT16(p + len - 2);
+			} else {
+				pc += len;
 			}
+		} else {
+			break;
+		}
+	}
+	sw->failedPos = pos;
+}
+
+void Logic::resetSlots() {
+	for (int i = 0; i < 0x40; ++i) {
+		ScriptSlot *slot = &_scriptSlots[i];
+		slot->pos = slot->nextPos = 0xFFFF;
+		slot->paused = slot->nextPaused = 0;
+	}
+	_scriptSlots[0].pos = 0;
+	resetSpinWaits();
+	_readyMask = 1;
+	_pausedMask = 0;
+	_pendingMask = 0;
+}
+
+void Logic::updateSlotMasks() {
+	resetSpinWaits();
+	_readyMask = _pausedMask = _pendingMask = 0;
+	for (int i = 0; i < 0x40; ++i) {
+		const ScriptSlot *slot = &_scriptSlots[i];
+		uint64 bit = (uint64)1 << i;
+		if (slot->paused != 0) {
+			_pausedMask |= bit;
+		} else if (slot->pos != 0xFFFF) {
+			_readyMask |= bit;
+		}
+		if (slot->nextPos != 0xFFFF || slot->nextPaused != slot->paused) {
+			_pendingMask |= bit;
 		}
 	}
 }
 
 void Logic::executeScript() {
+#ifdef USE_PROFILER
+	// one opcode at a time, so that each one can be timed and attributed
 	while (!_scriptHalted) {
-		uint8 opcode = _scriptPtr.fetchByte();
-		if (opcode & 0x80) {
-			uint16 off = ((opcode << 8) | _scriptPtr.fetchByte()) * 2;
-			_res->_useSegVideo2 = false;
-			int16 x = _scriptPtr.fetchByte();
-			int16 y = _scriptPtr.fetchByte();
-			int16 h = y - 199;
-			if (h > 0) {
-				y = 199;
-				x += h;
+		uint16 pos = _scriptPtr.pc - _res->_segCode;
+		uint8 opcode = *_scriptPtr.pc;
+		uint64 t = Profiler::now();
+		executeOpcode();
+		_prof.addOp(pos, opcode, Profiler::now() - t);
+		++_profInsns;
+	}
+	return;
+#endif
+#ifdef USE_AOT_SCRIPTS
+	if (_aot) {
+		(*_aot)(this);
+		if (_scriptHalted) {
+			return;
+		}
+		// the code segment has been patched, continue with the bytecode
+	}
+#endif
+#ifdef USE_SCRIPT_DECODER
+	if (_codeVerified) {
+		executeDecoded<false>();
+	} else {
+		executeDecoded<true>();
+	}
+#else
+	if (_codeVerified) {
+		while (!_scriptHalted) {
+			if (!executeFused()) {
+				executeVerifiedOpcode();
 			}
-			debug(DBG_VIDEO, "vid_opcd_0x80 : opcode=0x%X off=0x%X x=%d y=%d", opcode, off, x, y);
-			_vid->setDataBuffer(_res->_segVideo1, off);
-			_vid->drawShape(0xFF, 0x40, Point(x,y));
-		} else if (opcode & 0x40) {
-			int16 x, y;
-			uint16 off = _scriptPtr.fetchWord() * 2;
-			x = _scriptPtr.fetchByte();
-			_res->_useSegVideo2 = false;
-			if (!(opcode & 0x20)) {
-				if (!(opcode & 0x10)) {
-					x = (x << 8) | _scriptPtr.fetchByte();
-				} else {
-					x = _scriptVars[x];
-				}
+		}
+	} else {
+		while (!_scriptHalted) {
+			if (!executeFused()) {
+				executeOpcode();
+			}
+		}
+	}
+#endif
+}
+
+void Logic::executeOpcode() {
+	dispatchOpcode<true>();
+}
+
+void Logic::executeVerifiedOpcode() {
+	dispatchOpcode<false>();
+}
+
+template <bool CHECKED>
+void Logic::dispatchOpcode() {
+	uint8 opcode = _scriptPtr.fetchByte();
+	if (opcode & 0x80) {
+		uint16 off = ((opcode << 8) | _scriptPtr.fetchByte()) * 2;
+		_res->_useSegVideo2 = false;
+		int16 x = _scriptPtr.fetchByte();
+		int16 y = _scriptPtr.fetchByte();
+		int16 h = y - 199;
+		if (h > 0) {
+			y = 199;
+			x += h;
+		}
+		debug(DBG_VIDEO, "vid_opcd_0x80 : opcode=0x%X off=0x%X x=%d y=%d", opcode, off, x, y);
+		_vid->setDataBuffer(_res->_segVideo1, off);
+		_vid->drawShape(0xFF, 0x40, Point(x,y));
+	} else if (opcode & 0x40) {
+		int16 x, y;
+		uint16 off = _scriptPtr.fetchWord() * 2;
+		x = _scriptPtr.fetchByte();
+		_res->_useSegVideo2 = false;
+		if (!(opcode & 0x20)) {
+			if (!(opcode & 0x10)) {
+				x = (x << 8) | _scriptPtr.fetchByte();
 			} else {
-				if (opcode & 0x10) {
-					x += 0x100;
-				}
+				x = _scriptVars[x];
 			}
-			y = _scriptPtr.fetchByte();
-			if (!(opcode & 8)) {
-				if (!(opcode & 4)) {
-					y = (y << 8) | _scriptPtr.fetchByte();
-				} else {
-					y = _scriptVars[y];
-				}
+		} else {
+			if (opcode & 0x10) {
+				x += 0x100;
 			}
-			uint16 zoom = _scriptPtr.fetchByte();
-			if (!(opcode & 2)) {
-				if (!(opcode & 1)) {
-					--_scriptPtr.pc;
-					zoom = 0x40;
-				} else {
-					zoom = _scriptVars[zoom];
-				}
+		}
+		y = _scriptPtr.fetchByte();
+		if (!(opcode & 8)) {
+			if (!(opcode & 4)) {
+				y = (y << 8) | _scriptPtr.fetchByte();
 			} else {
-				if (opcode & 1) {
-					_res->_useSegVideo2 = true;
-					--_scriptPtr.pc;
-					zoom = 0x40;
-				}
+				y = _scriptVars[y];
 			}
-			debug(DBG_VIDEO, "vid_opcd_0x40 : off=0x%X x=%d y=%d", off, x, y);
-			_vid->setDataBuffer(_res->_useSegVideo2 ? _res->_segVideo2 : _res->_segVideo1, off);
-			_vid->drawShape(0xFF, zoom, Point(x, y));
+		}
+		uint16 zoom = _scriptPtr.fetchByte();
+		if (!(opcode & 2)) {
+			if (!(opcode & 1)) {
+				--_scriptPtr.pc;
+				zoom = 0x40;
+			} else {
+				zoom = _scriptVars[zoom];
+			}
+		} else {
+			if (opcode & 1) {
+				_res->_useSegVideo2 = true;
+				--_scriptPtr.pc;
+				zoom = 0x40;
+			}
+		}
+		debug(DBG_VIDEO, "vid_opcd_0x40 : off=0x%X x=%d y=%d", off, x, y);
+		_vid->setDataBuffer(_res->_useSegVideo2 ? _res->_segVideo2 : _res->_segVideo1, off);
+		_vid->drawShape(0xFF, zoom, Point(x, y));
+	} else if (CHECKED) {
+		if (opcode > 0x1A) {
+			error("Logic::executeScript() ec=0x%X invalid opcode=0x%X", 0xFFF, opcode);
 		} else {
-			if (opcode > 0x1A) {
-				error("Logic::executeScript() ec=0x%X invalid opcode=0x%X", 0xFFF, opcode);
+			(this->*_opTable[opcode])();
+		}
+	} else {
+		(this->*_verifiedOpTable[opcode])();
+	}
+}
+
+// the handlers bound to the decoded ops belong to one instantiation, _dec is
+// reset by setupCode() and invalidateCode() whenever _codeVerified changes
+template <bool CHECKED>
+void Logic::executeDecoded() {
+#if defined(__GNUC__)
+	static const void *const labels[Decoder::DOP_COUNT] = {
+		&&L_0x00, &&L_0x01, &&L_0x02, &&L_0x03, &&L_0x04, &&L_0x05, &&L_0x06, &&L_0x07,
+		&&L_0x08, &&L_0x09, &&L_0x0A, &&L_0x1D, &&L_0x1D, &&L_0x1D, &&L_0x1D, &&L_0x1D,
+		&&L_0x1D, &&L_0x11, &&L_0x1D, &&L_0x13, &&L_0x14, &&L_0x15, &&L_0x16, &&L_0x17,
+		&&L_0x1D, &&L_0x1D, &&L_0x1D, &&L_0x1B, &&L_0x1C, &&L_0x1D, &&L_0x1E
+	};
+#define DEC_CASE(x) L_##x
+#define DEC_DISPATCH() goto *op->handler
+#define DEC_BIND() \
+	for (; _dec._numBound < _dec._numOps; ++_dec._numBound) { \
+		DecodedOp *b = &_dec._ops[_dec._numBound]; \
+		b->handler = labels[b->opcode]; \
+	}
+#else
+#define DEC_CASE(x) case x
+#define DEC_DISPATCH() goto dispatch
+#define DEC_BIND() _dec._numBound = _dec._numOps
+#endif
+#ifdef SCRIPT_JIT_ENABLED
+#define DEC_HIT() \
+	if (_jit.hit(op - ops) && _jit.compile(op - ops)) { \
+		op->handler = &&L_NATIVE; \
+	}
+#else
+#define DEC_HIT()
+#endif
+
+	uint8 *seg = _res->_segCode;
+	int16 *vars = _scriptVars;
+	DecodedOp *ops;
+	DecodedOp *op;
+	uint16 pos = _scriptPtr.pc - seg;
+
+lookup:
+	op = &_dec._ops[_dec.lookup(pos)];
+	DEC_BIND();
+	ops = _dec._ops;
+	DEC_HIT();
+#if defined(__GNUC__)
+	DEC_DISPATCH();
+#else
+dispatch:
+	switch (op->opcode) {
+#endif
+
+	DEC_CASE(0x00): // op_movConst
+		vars[op->args[0]] = op->args[1];
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x01): // op_mov
+		vars[op->args[0]] = vars[op->args[1]];
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x02): // op_add
+		vars[op->args[0]] += vars[op->args[1]];
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x03): // op_addConst
+		vars[op->args[0]] += (int16)op->args[1];
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x04): // op_call
+		_scriptStackCalls[_stackPtr] = op->next;
+		if (CHECKED && _stackPtr == 0xFF) {
+			error("Logic::op_call() ec=0x%X stack overflow", 0x8F);
+		}
+		++_stackPtr;
+		op = ops + op->target;
+		DEC_HIT();
+		DEC_DISPATCH();
+	DEC_CASE(0x05): // op_ret
+		if (CHECKED && _stackPtr == 0) {
+			error("Logic::op_ret() ec=0x%X stack underflow", 0x8F);
+		}
+		--_stackPtr;
+		pos = _scriptStackCalls[_stackPtr];
+		goto lookup;
+	DEC_CASE(0x06): // op_break
+		_scriptPtr.pc = seg + op->next;
+		_scriptHalted = true;
+		return;
+	DEC_CASE(0x07): // op_jmp
+		op = ops + op->target;
+		DEC_HIT();
+		DEC_DISPATCH();
+	DEC_CASE(0x08): // op_setScriptSlot
+		setScriptSlot(op->args[0], op->args[1]);
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x09): // op_jnz
+		--vars[op->args[0]];
+		if (vars[op->args[0]] != 0) {
+			op = ops + op->target;
+			DEC_HIT();
+		} else {
+			++op;
+		}
+		DEC_DISPATCH();
+	DEC_CASE(0x0A): { // op_condJmp
+			int16 b = vars[op->args[0]];
+			int16 a = op->args[1];
+			if (op->flags & Decoder::DF_COND_VAR) {
+				a = vars[a];
+			}
+			if (Decoder::evalCond(op->flags & Decoder::DF_COND_MASK, b, a)) {
+				op = ops + op->target;
+				DEC_HIT();
 			} else {
-				(this->*_opTable[opcode])();
+				++op;
+			}
+		}
+		DEC_DISPATCH();
+	DEC_CASE(0x11): // op_halt
+		_scriptPtr.pc = seg + 0xFFFF;
+		_scriptHalted = true;
+		return;
+	DEC_CASE(0x13): // op_sub
+		vars[op->args[0]] -= vars[op->args[1]];
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x14): // op_and
+		vars[op->args[0]] = (uint16)vars[op->args[0]] & op->args[1];
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x15): // op_or
+		vars[op->args[0]] = (uint16)vars[op->args[0]] | op->args[1];
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x16): // op_shl
+		vars[op->args[0]] = (uint16)vars[op->args[0]] << op->args[1];
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x17): // op_shr
+		vars[op->args[0]] = (uint16)vars[op->args[0]] >> op->args[1];
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x1B): // Decoder::DOP_VIDEO_80
+		_res->_useSegVideo2 = false;
+		_vid->setDataBuffer(_res->_segVideo1, op->args[0]);
+		_vid->drawShape(0xFF, 0x40, Point(op->args[1], op->args[2]));
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x1C): { // Decoder::DOP_VIDEO_40
+			int16 x = op->args[1];
+			if (op->flags & Decoder::DF_X_VAR) {
+				x = vars[x];
+			}
+			int16 y = op->args[2];
+			if (op->flags & Decoder::DF_Y_VAR) {
+				y = vars[y];
+			}
+			uint16 zoom = op->args[3];
+			if (op->flags & Decoder::DF_ZOOM_VAR) {
+				zoom = vars[zoom];
 			}
+			_res->_useSegVideo2 = (op->flags & Decoder::DF_SEG_VIDEO2) != 0;
+			_vid->setDataBuffer(_res->_useSegVideo2 ? _res->_segVideo2 : _res->_segVideo1, op->args[0]);
+			_vid->drawShape(0xFF, zoom, Point(x, y));
+		}
+		++op;
+		DEC_DISPATCH();
+	DEC_CASE(0x1D): // Decoder::DOP_INTERPRET
+		_scriptPtr.pc = seg + op->pos;
+		dispatchOpcode<CHECKED>();
+		if (_scriptHalted) {
+			return;
 		}
+		pos = _scriptPtr.pc - seg;
+		goto lookup;
+	DEC_CASE(0x1E): // Decoder::DOP_GOTO
+		op = ops + op->target;
+		DEC_HIT();
+		DEC_DISPATCH();
+#ifdef SCRIPT_JIT_ENABLED
+	L_NATIVE: {
+			uint32 ret = _jit.run(op - ops);
+			if (ret & Jit::RET_LOOKUP) {
+				pos = ret & 0xFFFF;
+				goto lookup;
+			}
+			op = ops + (ret & 0xFFFF);
+			if (ret & Jit::RET_INTERPRET) {
+				goto L_0x1D;
+			}
+		}
+		DEC_DISPATCH();
+#endif
+
+#if !defined(__GNUC__)
+	default:
+		goto lookup;
+	}
+#endif
+
+#undef DEC_CASE
+#undef DEC_DISPATCH
+#undef DEC_BIND
+#undef DEC_HIT
+}
+
+bool Logic::executeFused() {
+#ifndef USE_SCRIPT_DECODER
+	uint8 *seg = _res->_segCode;
+	const FusedOp *fo = _peep.lookup(_scriptPtr.pc - seg);
+	if (!fo) {
+		return false;
+	}
+	++_peep._hits[fo->kind];
+	switch (fo->kind) {
+	case Peephole::FK_MOV_CONST:
+		_scriptVars[fo->var] = fo->value;
+		break;
+	case Peephole::FK_ADD_CONST:
+		_scriptVars[fo->var] += fo->value;
+		break;
+	case Peephole::FK_COND_JMP: {
+			int16 b = _scriptVars[fo->var];
+			int16 a = fo->value;
+			if (fo->flags & Decoder::DF_COND_VAR) {
+				a = _scriptVars[a];
+			}
+			const bool expr = Decoder::evalCond(fo->flags & Decoder::DF_COND_MASK, b, a);
+			_scriptPtr.pc = seg + (expr ? fo->target : fo->next);
+		}
+		return true;
+	case Peephole::FK_LOOP:
+		_scriptVars[fo->counter] = 0;
+		break;
+	case Peephole::FK_LOOP_ADD: {
+			uint32 n = (uint16)_scriptVars[fo->counter];
+			if (n == 0) {
+				n = 0x10000;
+			}
+			_scriptVars[fo->var] += (uint16)(fo->value * n);
+			_scriptVars[fo->counter] = 0;
+		}
+		break;
+	case Peephole::FK_LOOP_MOV:
+		_scriptVars[fo->var] = fo->value;
+		_scriptVars[fo->counter] = 0;
+		break;
+	}
+	_scriptPtr.pc = seg + fo->next;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Logic::setupCode() {
+	CodeCache *cache = &_res->_cache;
+	cache->open(_res->_segCode, _res->_segCodeSize);
+	uint32 size;
+#ifdef USE_SCRIPT_DECODER
+	const uint8 *ops = cache->find('DECO', &size);
+	if (!ops || !_dec.restore(_res->_segCode, _res->_segCodeSize, _res->_curPtrsId, ops, size)) {
+		_dec.setup(_res->_segCode, _res->_segCodeSize, _res->_curPtrsId);
+		cache->add('DECO', _dec._ops, _dec._numOps * sizeof(DecodedOp));
 	}
+#else
+	const uint8 *fused = cache->find('PEEP', &size);
+	if (!fused || !_peep.restore(_res->_segCodeSize, _res->_curPtrsId, fused, size)) {
+		_peep.setup(_res->_segCode, _res->_segCodeSize, _res->_curPtrsId);
+		cache->add('PEEP', _peep._fused, _peep._numFused * sizeof(FusedOp));
+	}
+#endif
+	cache->flush();
+#ifdef SCRIPT_JIT_ENABLED
+	_jit.setup(&_dec, _scriptVars, _scriptStackCalls, &_stackPtr);
+#endif
+#ifdef USE_AOT_SCRIPTS
+	_aot = 0;
+	for (const AotPart *ap = g_aotParts; ap->proc; ++ap) {
+		if (ap->ptrsId == _res->_curPtrsId && ap->size == _res->_segCodeSize && ap->checksum == hash32(_res->_segCode, _res->_segCodeSize)) {
+			_aot = ap->proc;
+			break;
+		}
+	}
+	debug(DBG_INFO, "Logic::setupCode() ptrsId=0x%X aot=%d", _res->_curPtrsId, _aot != 0);
+#endif
+#ifdef USE_PROFILER
+	_prof.setPart(_res->_curPtrsId);
+#endif
+	if (_deps) {
+		_deps->setup(_res->_segCode, _res->_segCodeSize, _res->_curPtrsId);
+	}
+	_codeSeg = _res->_segCode;
+	_codeVerified = _res->_segCodeVerified && areSlotsVerified();
+}
+
+bool Logic::areSlotsVerified() const {
+	// slots restored from a saved game may not start from a verified offset
+	for (int i = 0; i < 0x40; ++i) {
+		const ScriptSlot *slot = &_scriptSlots[i];
+		if (slot->pos != 0xFFFF && !_res->_verifier.isEntry(slot->pos)) {
+			return false;
+		}
+		if (slot->nextPos < 0xFFFE && !_res->_verifier.isEntry(slot->nextPos)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void Logic::invalidateCode() {
+	resetSpinWaits();
+	_res->verifyCode();
+	_codeVerified = _res->_segCodeVerified && areSlotsVerified();
+	if (_deps) {
+		_deps->setup(_res->_segCode, _res->_segCodeSize, _res->_curPtrsId);
+	}
+#ifdef USE_SCRIPT_DECODER
+	_dec.invalidate();
+#else
+	_peep.setup(_res->_segCode, _res->_segCodeSize, _res->_curPtrsId);
+#endif
+#ifdef SCRIPT_JIT_ENABLED
+	_jit.reset();
+#endif
+#ifdef USE_AOT_SCRIPTS
+	_aot = 0;
+#endif
 }
 
 void Logic::inp_updatePlayer() {
@@ -552,12 +1172,40 @@ void Logic::snd_playMusic(uint16 resNum, uint16 delay, uint8 pos) {
 }
 
 void Logic::saveOrLoad(Serializer &ser) {
+	// the slots used to be stored as two parallel [2][0x40] arrays following
+	// the 0x40 entries stack, which was itself saved with 0x100 entries
+	uint16 stackCalls[0x100];
+	uint16 slotsPos[2][0x40];
+	uint8 paused[2][0x40];
+	if (ser._mode == Serializer::SM_SAVE) {
+		for (int i = 0; i < 0x40; ++i) {
+			slotsPos[0][i] = _scriptSlots[i].pos;
+			slotsPos[1][i] = _scriptSlots[i].nextPos;
+			paused[0][i] = _scriptSlots[i].paused;
+			paused[1][i] = _scriptSlots[i].nextPaused;
+		}
+		memcpy(stackCalls, _scriptStackCalls, 0x40 * sizeof(uint16));
+		memcpy(stackCalls + 0x40, slotsPos, sizeof(slotsPos));
+		memcpy(stackCalls + 0xC0, paused, sizeof(paused));
+	}
 	Serializer::Entry entries[] = {
 		SE_ARRAY(_scriptVars, 0x100, Serializer::SES_INT16, VER(1)),
-		SE_ARRAY(_scriptStackCalls, 0x100, Serializer::SES_INT16, VER(1)),
-		SE_ARRAY(_scriptSlotsPos, 0x40 * 2, Serializer::SES_INT16, VER(1)),
-		SE_ARRAY(_scriptPaused, 0x40 * 2, Serializer::SES_INT8, VER(1)),
+		SE_ARRAY(stackCalls, 0x100, Serializer::SES_INT16, VER(1)),
+		SE_ARRAY(slotsPos, 0x40 * 2, Serializer::SES_INT16, VER(1)),
+		SE_ARRAY(paused, 0x40 * 2, Serializer::SES_INT8, VER(1)),
 		SE_END()
 	};
 	ser.saveOrLoadEntries(entries);
+	if (ser._mode == Serializer::SM_LOAD) {
+		memcpy(_scriptStackCalls, stackCalls, 0x40 * sizeof(uint16));
+		for (int i = 0; i < 0x40; ++i) {
+			_scriptSlots[i].pos = slotsPos[0][i];
+			_scriptSlots[i].nextPos = slotsPos[1][i];
+			_scriptSlots[i].paused = paused[0][i];
+			_scriptSlots[i].nextPaused = paused[1][i];
+		}
+		updateSlotMasks();
+		// the code segment is reloaded by Resource::saveOrLoad()
+		_codeSeg = 0;
+	}
 }
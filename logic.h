@@ -20,6 +20,13 @@
 #define __LOGIC_H__
 
 #include "intern.h"
+#include "aot.h"
+#include "decoder.h"
+#include "jit.h"
+#include "peephole.h"
+#include "profiler.h"
+#include "scriptdeps.h"
+#include "workerpool.h"
 
 struct Mixer;
 struct Resource;
@@ -31,6 +38,27 @@ struct Video;
 struct Logic {
 	typedef void (Logic::*OpcodeStub)();
 
+	struct ScriptSlot {
+		uint16 pos;       // 0xFFFF when the slot is stopped
+		uint16 nextPos;   // applied on the next frame, 0xFFFE stops the slot
+		uint8 paused;
+		uint8 nextPaused; // applied on the next frame
+	};
+
+	enum {
+		MAX_SPIN_VARS  = 4,
+		MAX_SPIN_STEPS = 8
+	};
+
+	// a slot polling variables with op_condJmp, op_jmp and op_break only
+	struct SpinWait {
+		uint16 pos;       // parked offset, 0xFFFF when the slot runs
+		uint16 failedPos; // offset the last detection failed at
+		uint8 numVars;
+		uint8 vars[MAX_SPIN_VARS];
+		int16 values[MAX_SPIN_VARS];
+	};
+
 	enum ScriptVars {
 		VAR_RANDOM_SEED          = 0x3C,
 		
@@ -50,6 +78,7 @@ struct Logic {
 	};
 	
 	static const OpcodeStub _opTable[];
+	static const OpcodeStub _verifiedOpTable[];
 	static const uint16 _freqTable[];
 
 	Mixer *_mix;
@@ -60,13 +89,36 @@ struct Logic {
 
 	int16 _scriptVar_0xBF;
 	int16 _scriptVars[0x100];
-	uint16 _scriptStackCalls[0x40];
-	uint16 _scriptSlotsPos[2][0x40];
-	uint8 _scriptPaused[2][0x40];
+	uint16 _scriptStackCalls[0x100];
+	ScriptSlot _scriptSlots[0x40];
+	uint64 _readyMask;   // running and not paused
+	uint64 _pausedMask;
+	uint64 _pendingMask; // nextPos or nextPaused to apply
+	SpinWait _spinWaits[0x40];
+	WorkerPool _workers;
+	ScriptDeps *_deps;
+	uint8 _batchSlots[0x40];
+	ScriptContext _batchContexts[0x40];
 	Ptr _scriptPtr;
 	uint8 _stackPtr;
 	bool _scriptHalted;
 	bool _fastMode;
+	uint8 *_codeSeg;
+	bool _codeVerified; // runtime checks proven unnecessary by Verifier
+	Decoder _dec;
+#ifdef SCRIPT_JIT_ENABLED
+	Jit _jit;
+#endif
+#ifdef USE_AOT_SCRIPTS
+	AotProc _aot;
+#endif
+#ifndef USE_SCRIPT_DECODER
+	Peephole _peep;
+#endif
+#ifdef USE_PROFILER
+	Profiler _prof;
+	uint32 _profInsns;
+#endif
 
 	Logic(Mixer *mix, Resource *res, SfxPlayer *ply, Video *vid, SystemStub *stub);
 	void init();
@@ -77,6 +129,8 @@ struct Logic {
 	void op_addConst();
 	void op_call();
 	void op_ret();
+	void op_callUnchecked();
+	void op_retUnchecked();
 	void op_break();
 	void op_jmp();
 	void op_setScriptSlot();
@@ -103,7 +157,30 @@ struct Logic {
 	void setupPtrs(uint16 ptrId);
 	void setupScripts();
 	void runScripts();
+	bool runBatch(uint64 &ready);
+	static void runBatchJob(void *param, int job);
+	void initWorkers(int numThreads);
+	void freeWorkers();
+	void resetSlots();
+	void updateSlotMasks();
+	void resetSpinWaits();
+	bool isSpinning(uint8 i, uint16 pos);
+	void detectSpinWait(uint8 i, uint16 pos);
+	void setScriptSlot(uint8 i, uint16 n) {
+		if (i < 0x40) {
+			_scriptSlots[i].nextPos = n;
+			_pendingMask |= (uint64)1 << i;
+		}
+	}
 	void executeScript();
+	void executeOpcode();
+	void executeVerifiedOpcode();
+	template <bool CHECKED> void dispatchOpcode();
+	template <bool CHECKED> void executeDecoded();
+	bool areSlotsVerified() const;
+	bool executeFused();
+	void setupCode();
+	void invalidateCode();
 
 	void inp_updatePlayer();
 	void inp_handleSpecialKeys();
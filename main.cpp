@@ -25,7 +25,15 @@ static const char *USAGE =
 	"Raw - Another World Interpreter\n"
 	"Usage: raw [OPTIONS]...\n"
 	"  --datapath=PATH   Path to where the game is installed (default '.')\n"
-	"  --savepath=PATH   Path to where the save files are stored (default '.')\n";
+	"  --savepath=PATH   Path to where the save files are stored (default '.')\n"
+	"  --cachepath=PATH  Path to where the translated scripts are cached (default none)\n"
+	"  --threads=N       Number of threads running the scripts (default 1)\n"
+	"  --spancache=KB    Memory used to replay the spans of the static shapes (default 0)\n"
+	"  --drawlists       Defer the drawing until the pages are read\n"
+	"  --hires=SCALE     Draw the polygons at SCALE times 320x200, up to 8 (default 1)\n"
+	"  --drawthreads=N   Number of threads drawing the polygons (default 1)\n"
+	"  --pagecache=KB    Memory used to keep the converted backgrounds (default 0)\n"
+	"  --drawtrace=FILE  Record the drawing to FILE in savepath, replayed by render_bench\n";
 
 static bool parseOption(const char *arg, const char *longCmd, const char **opt) {
 	bool ret = false;
@@ -42,11 +50,27 @@ static bool parseOption(const char *arg, const char *longCmd, const char **opt)
 int main(int argc, char *argv[]) {
 	const char *dataPath = ".";
 	const char *savePath = ".";
+	const char *cachePath = 0;
+	const char *threads = "1";
+	const char *spanCache = "0";
+	const char *drawLists = 0;
+	const char *hires = "1";
+	const char *drawThreads = "1";
+	const char *pageCache = "0";
+	const char *drawTrace = 0;
 	for (int i = 1; i < argc; ++i) {
 		bool opt = false;
 		if (strlen(argv[i]) >= 2) {
 			opt |= parseOption(argv[i], "datapath=", &dataPath);
 			opt |= parseOption(argv[i], "savepath=", &savePath);
+			opt |= parseOption(argv[i], "cachepath=", &cachePath);
+			opt |= parseOption(argv[i], "threads=", &threads);
+			opt |= parseOption(argv[i], "spancache=", &spanCache);
+			opt |= parseOption(argv[i], "drawlists", &drawLists);
+			opt |= parseOption(argv[i], "hires=", &hires);
+			opt |= parseOption(argv[i], "drawthreads=", &drawThreads);
+			opt |= parseOption(argv[i], "pagecache=", &pageCache);
+			opt |= parseOption(argv[i], "drawtrace=", &drawTrace);
 		}
 		if (!opt) {
 			printf(USAGE);
@@ -54,8 +78,24 @@ int main(int argc, char *argv[]) {
 		}
 	}
 	g_debugMask = DBG_INFO; // DBG_LOGIC | DBG_BANK | DBG_VIDEO | DBG_SER | DBG_SND
+	double scale = atof(hires);
+	if (scale < 1.) {
+		scale = 1.;
+	} else if (scale > 8.) {
+		scale = 8.;
+	}
+	EngineOptions opts;
+	opts.cacheDir = cachePath;
+	opts.numThreads = atoi(threads);
+	opts.spanCacheSize = atoi(spanCache) * 1024;
+	opts.drawLists = drawLists != 0;
+	opts.renderW = (uint16)(Video::VID_PAGE_W * scale + .5);
+	opts.renderH = (uint16)(Video::VID_PAGE_H * scale + .5);
+	opts.drawThreads = atoi(drawThreads);
+	opts.pageCacheSize = atoi(pageCache) * 1024;
+	opts.renderTrace = drawTrace;
 	SystemStub *stub = SystemStub_SDL_create();
-	Engine *e = new Engine(stub, dataPath, savePath);
+	Engine *e = new Engine(stub, dataPath, savePath, opts);
 	e->run();
 	delete e;
 	delete stub;
@@ -0,0 +1,73 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "pagecache.h"
+
+
+PageCache::PageCache()
+	: _maxPages(0), _numEntries(0), _useCounter(0), _hits(0), _misses(0) {
+}
+
+PageCache::~PageCache() {
+	dumpStats();
+}
+
+void PageCache::init(uint32 maxSize, uint32 pageSize) {
+	_maxPages = MIN(maxSize / pageSize, (uint32)MAX_PAGES);
+}
+
+void PageCache::dumpStats() {
+	if (_hits + _misses != 0) {
+		debug(DBG_INFO, "PageCache hits=%lu misses=%lu pages=%d", _hits, _misses, _numEntries);
+	}
+}
+
+// the buffer holding the background of the resource entry
+uint8 PageCache::find(uint16 resNum) {
+	for (int i = 0; i < _numEntries; ++i) {
+		Entry *e = &_entries[i];
+		if (e->resNum == resNum) {
+			e->lastUse = ++_useCounter;
+			++_hits;
+			return e->buf;
+		}
+	}
+	++_misses;
+	return NO_BUF;
+}
+
+// returns the buffer of the entry evicted to make room, if any
+uint8 PageCache::add(uint16 resNum, uint8 buf) {
+	uint8 evicted = NO_BUF;
+	Entry *e = &_entries[_numEntries];
+	if (_numEntries == _maxPages) {
+		e = &_entries[0];
+		for (int i = 1; i < _numEntries; ++i) {
+			if (_entries[i].lastUse < e->lastUse) {
+				e = &_entries[i];
+			}
+		}
+		evicted = e->buf;
+	} else {
+		++_numEntries;
+	}
+	e->resNum = resNum;
+	e->buf = buf;
+	e->lastUse = ++_useCounter;
+	return evicted;
+}
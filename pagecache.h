@@ -0,0 +1,53 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __PAGECACHE_H__
+#define __PAGECACHE_H__
+
+#include "intern.h"
+
+// backgrounds already converted to page images, keyed by their resource
+// entry. The images are page buffers of Video, page 0 shares them on a hit.
+struct PageCache {
+	enum {
+		MAX_PAGES = 16,
+		NO_BUF = 0xFF
+	};
+
+	struct Entry {
+		uint16 resNum;
+		uint8 buf;
+		uint32 lastUse;
+	};
+
+	uint8 _maxPages; // 0 disables the cache
+	Entry _entries[MAX_PAGES];
+	uint8 _numEntries;
+	uint32 _useCounter;
+	uint32 _hits, _misses;
+
+	PageCache();
+	~PageCache();
+
+	void init(uint32 maxSize, uint32 pageSize);
+	void dumpStats();
+	uint8 find(uint16 resNum);
+	uint8 add(uint16 resNum, uint8 buf);
+};
+
+#endif
@@ -0,0 +1,190 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "peephole.h"
+#include "decoder.h"
+
+
+static const DecodedOp *nextOp(const Decoder *dec, const DecodedOp *op) {
+	++op;
+	if (op->opcode == Decoder::DOP_GOTO) {
+		op = &dec->_ops[op->target];
+	}
+	return op;
+}
+
+Peephole::Peephole()
+	: _ptrsId(0), _fused(0), _numFused(0) {
+	_offsetMap = (uint16 *)malloc(0x10000 * sizeof(uint16));
+	if (!_offsetMap) {
+		error("Peephole::Peephole() unable to allocate offset map");
+	}
+	memset(_offsetMap, 0xFF, 0x10000 * sizeof(uint16));
+	memset(_sites, 0, sizeof(_sites));
+	memset(_hits, 0, sizeof(_hits));
+}
+
+Peephole::~Peephole() {
+	dumpStats();
+	free(_fused);
+	free(_offsetMap);
+}
+
+void Peephole::setup(const uint8 *seg, uint16 segSize, uint16 ptrsId) {
+	reset(ptrsId);
+	// the decoder follows the control flow, so data bytes are never matched
+	Decoder dec;
+	dec.setup(seg, segSize, ptrsId);
+	free(_fused);
+	_fused = (FusedOp *)malloc(dec._numOps * sizeof(FusedOp));
+	if (!_fused) {
+		error("Peephole::setup() unable to allocate %d fused ops", dec._numOps);
+	}
+	for (uint16 i = 0; i < dec._numOps; ++i) {
+		const DecodedOp *op = &dec._ops[i];
+		if (op->opcode == Decoder::DOP_GOTO) {
+			continue;
+		}
+		FusedOp *fo = &_fused[_numFused];
+		if (matchLoop(&dec, i, fo) || matchCondJmp(&dec, i, fo) || matchChain(&dec, i, fo)) {
+			fo->pos = op->pos;
+			_offsetMap[op->pos] = _numFused++;
+			++_sites[fo->kind];
+		}
+	}
+	debug(DBG_LOGIC, "Peephole::setup() ptrsId=0x%X fused %d sequences", ptrsId, _numFused);
+}
+
+// reuses the sequences of a previous setup() on the same segment, see CodeCache
+bool Peephole::restore(uint16 segSize, uint16 ptrsId, const uint8 *data, uint32 size) {
+	reset(ptrsId);
+	uint32 numFused = size / sizeof(FusedOp);
+	if (numFused == 0 || numFused >= NO_INDEX || size != numFused * sizeof(FusedOp)) {
+		return false;
+	}
+	const FusedOp *fused = (const FusedOp *)data;
+	for (uint32 i = 0; i < numFused; ++i) {
+		const FusedOp *fo = &fused[i];
+		if (fo->kind >= FK_COUNT || fo->pos >= segSize || fo->next > segSize || fo->target >= segSize) {
+			warning("Peephole::restore() ptrsId=0x%X invalid sequence %d", ptrsId, i);
+			return false;
+		}
+	}
+	free(_fused);
+	_fused = (FusedOp *)malloc(size);
+	if (!_fused) {
+		error("Peephole::restore() unable to allocate %lu fused ops", numFused);
+	}
+	memcpy(_fused, data, size);
+	for (_numFused = 0; _numFused < numFused; ++_numFused) {
+		const FusedOp *fo = &_fused[_numFused];
+		_offsetMap[fo->pos] = _numFused;
+		++_sites[fo->kind];
+	}
+	debug(DBG_LOGIC, "Peephole::restore() ptrsId=0x%X restored %d sequences", ptrsId, _numFused);
+	return true;
+}
+
+void Peephole::reset(uint16 ptrsId) {
+	dumpStats();
+	_ptrsId = ptrsId;
+	_numFused = 0;
+	memset(_offsetMap, 0xFF, 0x10000 * sizeof(uint16));
+	memset(_sites, 0, sizeof(_sites));
+	memset(_hits, 0, sizeof(_hits));
+}
+
+void Peephole::dumpStats() {
+	if (_ptrsId == 0) {
+		return;
+	}
+	char buf[256];
+	int len = 0;
+	for (int i = 0; i < FK_COUNT; ++i) {
+		len += snprintf(buf + len, sizeof(buf) - len, " %s=%lu/%lu", _kindNames[i], _sites[i], _hits[i]);
+	}
+	debug(DBG_INFO, "Peephole ptrsId=0x%X sites/hits%s", _ptrsId, buf);
+}
+
+bool Peephole::matchLoop(const Decoder *dec, uint16 i, FusedOp *fo) {
+	const DecodedOp *op = &dec->_ops[i];
+	if (op->opcode == 0x09 && op->target == i) {
+		fo->kind = FK_LOOP;
+		fo->counter = op->args[0];
+		fo->next = op->next;
+		return true;
+	}
+	if (op->opcode != 0x00 && op->opcode != 0x03) {
+		return false;
+	}
+	// the body runs once per count, 0 wraps around to 65536 iterations
+	const DecodedOp *jnz = nextOp(dec, op);
+	if (jnz->opcode != 0x09 || jnz->target != i || jnz->args[0] == op->args[0]) {
+		return false;
+	}
+	fo->kind = (op->opcode == 0x00) ? FK_LOOP_MOV : FK_LOOP_ADD;
+	fo->var = op->args[0];
+	fo->counter = jnz->args[0];
+	fo->value = op->args[1];
+	fo->next = jnz->next;
+	return true;
+}
+
+bool Peephole::matchCondJmp(const Decoder *dec, uint16 i, FusedOp *fo) {
+	const DecodedOp *op = &dec->_ops[i];
+	if (op->opcode != 0x0A) {
+		return false;
+	}
+	const DecodedOp *jmp = nextOp(dec, op);
+	if (jmp->opcode != 0x07) {
+		return false;
+	}
+	fo->kind = FK_COND_JMP;
+	fo->flags = op->flags;
+	fo->var = op->args[0];
+	fo->value = op->args[1];
+	fo->target = dec->_ops[op->target].pos;
+	fo->next = dec->_ops[jmp->target].pos;
+	return true;
+}
+
+bool Peephole::matchChain(const Decoder *dec, uint16 i, FusedOp *fo) {
+	const DecodedOp *op = &dec->_ops[i];
+	uint8 var = op->args[0];
+	bool mov = false;
+	uint16 value = 0;
+	int count = 0;
+	while ((op->opcode == 0x00 || op->opcode == 0x03) && op->args[0] == var) {
+		if (op->opcode == 0x00) {
+			mov = true;
+			value = op->args[1];
+		} else {
+			value += op->args[1];
+		}
+		++count;
+		fo->next = op->next;
+		op = nextOp(dec, op);
+	}
+	if (count < 2) {
+		return false;
+	}
+	fo->kind = mov ? FK_MOV_CONST : FK_ADD_CONST;
+	fo->var = var;
+	fo->value = value;
+	return true;
+}
@@ -0,0 +1,79 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __PEEPHOLE_H__
+#define __PEEPHOLE_H__
+
+#include "intern.h"
+
+struct Decoder;
+struct DecodedOp;
+
+struct FusedOp {
+	uint8 kind;     // Peephole::FusedKind
+	uint8 flags;    // FK_COND_JMP condition, Decoder::DF_COND_*
+	uint8 var;
+	uint8 counter;  // FK_LOOP_* counter variable
+	uint16 value;
+	uint16 next;    // offset following the sequence, or condition not met
+	uint16 target;  // FK_COND_JMP condition met
+	uint16 pos;     // bytecode offset of the sequence
+};
+
+struct Peephole {
+	enum FusedKind {
+		FK_MOV_CONST, // chain of op_movConst/op_addConst ending with a constant
+		FK_ADD_CONST, // chain of op_addConst
+		FK_COND_JMP,  // op_condJmp followed by op_jmp
+		FK_LOOP,      // op_jnz to itself
+		FK_LOOP_ADD,  // op_addConst and op_jnz back to it
+		FK_LOOP_MOV,  // op_movConst and op_jnz back to it
+		FK_COUNT
+	};
+
+	enum {
+		NO_INDEX = 0xFFFF
+	};
+
+	static const char *_kindNames[];
+
+	uint16 _ptrsId;
+	FusedOp *_fused;
+	uint16 _numFused;
+	uint16 *_offsetMap;
+	uint32 _sites[FK_COUNT];
+	uint32 _hits[FK_COUNT];
+
+	Peephole();
+	~Peephole();
+
+	void setup(const uint8 *seg, uint16 segSize, uint16 ptrsId);
+	bool restore(uint16 segSize, uint16 ptrsId, const uint8 *data, uint32 size);
+	void reset(uint16 ptrsId);
+	void dumpStats();
+	const FusedOp *lookup(uint16 pos) const {
+		uint16 i = _offsetMap[pos];
+		return (i == NO_INDEX) ? 0 : &_fused[i];
+	}
+
+	bool matchLoop(const Decoder *dec, uint16 i, FusedOp *fo);
+	bool matchCondJmp(const Decoder *dec, uint16 i, FusedOp *fo);
+	bool matchChain(const Decoder *dec, uint16 i, FusedOp *fo);
+};
+
+#endif
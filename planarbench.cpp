@@ -0,0 +1,160 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "profiler.h"
+#include "spanfill.h"
+#include "util.h"
+
+
+static const char *USAGE =
+	"Raw - Another World Interpreter, background conversion benchmark\n"
+	"Usage: planar_bench [OPTIONS]...\n"
+	"  --pages=N    Number of random backgrounds converted (default 16)\n"
+	"  --repeat=N   Number of timed conversions, the best is reported (default 5)\n";
+
+enum {
+	PAGE_W = 320,
+	PAGE_H = 200,
+	PLANE_SIZE = PAGE_W * PAGE_H / 8
+};
+
+typedef void (*PlanarProc)(uint8 *dst, const uint8 *src, uint32 planeSize, uint16 w);
+
+static bool parseOption(const char *arg, const char *longCmd, const char **opt) {
+	bool ret = false;
+	if (arg[0] == '-' && arg[1] == '-') {
+		if (strncmp(arg + 2, longCmd, strlen(longCmd)) == 0) {
+			*opt = arg + 2 + strlen(longCmd);
+			ret = true;
+		}
+	}
+	return ret;
+}
+
+// as Video::copyPagePtr() at 320x200
+static void convert(PlanarProc planar, uint8 *dst, const uint8 *src) {
+	for (int y = 0; y < PAGE_H; ++y) {
+		planar(dst, src, PLANE_SIZE, PAGE_W);
+		dst += PAGE_W;
+		src += PAGE_W / 8;
+	}
+}
+
+static uint64 timeConversions(PlanarProc planar, uint8 *dst, const uint8 *src, int numPages, int count) {
+	uint64 best = 0;
+	for (int i = 0; i < count; ++i) {
+		const uint64 t0 = Profiler::now();
+		for (int j = 0; j < numPages; ++j) {
+			convert(planar, dst + j * PAGE_W * PAGE_H, src + j * PLANE_SIZE * 4);
+		}
+		const uint64 t = Profiler::now() - t0;
+		if (i == 0 || t < best) {
+			best = t;
+		}
+	}
+	return best;
+}
+
+int main(int argc, char *argv[]) {
+	const char *pages = "16";
+	const char *repeat = "5";
+	for (int i = 1; i < argc; ++i) {
+		bool opt = false;
+		if (strlen(argv[i]) >= 2) {
+			opt |= parseOption(argv[i], "pages=", &pages);
+			opt |= parseOption(argv[i], "repeat=", &repeat);
+		}
+		if (!opt) {
+			printf(USAGE);
+			return 0;
+		}
+	}
+	g_debugMask = DBG_INFO;
+	const int numPages = MAX(atoi(pages), 1);
+	const int count = MAX(atoi(repeat), 1);
+	const SpanKernels *kernels[] = {
+		&g_spanKernelsScalar,
+#ifdef SPAN_SIMD_ENABLED
+		&g_spanKernelsSSE2,
+		&g_spanKernelsAVX2,
+#endif
+	};
+	const int numKernels = ARRAYSIZE(kernels);
+	const SpanKernels *selected = getSpanKernels();
+
+	uint8 *src = (uint8 *)malloc(numPages * PLANE_SIZE * 4);
+	uint8 *ref = (uint8 *)malloc(numPages * PAGE_W * PAGE_H);
+	uint8 *dst = (uint8 *)malloc(numPages * PAGE_W * PAGE_H);
+	if (!src || !ref || !dst) {
+		error("Unable to allocate %d pages", numPages);
+	}
+	srand(0x3E80);
+	for (int i = 0; i < numPages * PLANE_SIZE * 4; ++i) {
+		src[i] = rand() >> 4;
+	}
+	const uint64 refTime = timeConversions(planarReference, ref, src, numPages, count);
+	printf("%d backgrounds, best of %d\n", numPages, count);
+	printf("%-18s %8.1f us/page\n", "reference", refTime / 1000. / numPages);
+
+	// the kernel sets sharing a conversion are timed once, under their names joined
+	int ret = 0;
+	for (int i = 0; i < numKernels; ++i) {
+		const PlanarProc planar = kernels[i]->planar;
+		bool timed = false;
+		for (int j = 0; j < i; ++j) {
+			timed |= (kernels[j]->planar == planar);
+		}
+		if (timed) {
+			continue;
+		}
+		char name[64] = "";
+		for (int j = i; j < numKernels; ++j) {
+			if (kernels[j]->planar == planar) {
+				if (name[0]) {
+					strcat(name, "/");
+				}
+				strcat(name, kernels[j]->name);
+			}
+		}
+#ifdef SPAN_SIMD_ENABLED
+		if (kernels[i] == &g_spanKernelsAVX2 && !__builtin_cpu_supports("avx2")) {
+			printf("%-18s not supported\n", name);
+			continue;
+		}
+#endif
+		memset(dst, 0, numPages * PAGE_W * PAGE_H);
+		const uint64 t = timeConversions(planar, dst, src, numPages, count);
+		uint32 mismatches = 0;
+		for (int j = 0; j < numPages * PAGE_W * PAGE_H; ++j) {
+			if (dst[j] != ref[j]) {
+				if (mismatches == 0) {
+					printf("%s differs at page %d x %d y %d: %d, expected %d\n", name, j / (PAGE_W * PAGE_H), j % PAGE_W, (j / PAGE_W) % PAGE_H, dst[j], ref[j]);
+				}
+				++mismatches;
+			}
+		}
+		if (mismatches != 0) {
+			ret = 1;
+		}
+		printf("%-18s %8.1f us/page, %.1fx%s, %lu pixels differ\n", name, t / 1000. / numPages, (double)refTime / MAX(t, (uint64)1), (planar == selected->planar) ? " (selected)" : "", (unsigned long)mismatches);
+	}
+	free(src);
+	free(ref);
+	free(dst);
+	return ret;
+}
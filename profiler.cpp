@@ -0,0 +1,134 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <cstdarg>
+#include <ctime>
+#include "profiler.h"
+#include "file.h"
+
+
+Profiler::Profiler()
+	: _cur(0) {
+	memset(_parts, 0, sizeof(_parts));
+	// calibrate the cost of the timer calls surrounding an opcode
+	_overhead = ~0ULL;
+	for (int i = 0; i < 1000; ++i) {
+		uint64 t0 = now();
+		uint64 t1 = now();
+		if (t1 - t0 < _overhead) {
+			_overhead = t1 - t0;
+		}
+	}
+}
+
+Profiler::~Profiler() {
+	for (int i = 0; i < NUM_PARTS; ++i) {
+		free(_parts[i].offsets);
+	}
+}
+
+uint64 Profiler::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void Profiler::setPart(uint16 ptrsId) {
+	_cur = 0;
+	if (ptrsId >= 0x3E80 && ptrsId < 0x3E80 + NUM_PARTS) {
+		PartStats *ps = &_parts[ptrsId - 0x3E80];
+		if (!ps->offsets) {
+			ps->offsets = (Counter *)calloc(0x10000, sizeof(Counter));
+			if (!ps->offsets) {
+				error("Profiler::setPart() unable to allocate offset counters");
+			}
+		}
+		_cur = ps;
+	}
+}
+
+static void writeLine(File &f, const char *fmt, ...) {
+	char buf[256];
+	va_list va;
+	va_start(va, fmt);
+	int len = vsnprintf(buf, sizeof(buf), fmt, va);
+	va_end(va);
+	f.write(buf, len);
+}
+
+static void writeCounter(File &f, uint16 ptrsId, const char *kind, const char *id, const Profiler::Counter *c) {
+	writeLine(f, "0x%X,%s,%s,%llu,%.3f\n", ptrsId, kind, id, c->count, c->time / 1000.);
+}
+
+void Profiler::dump(const char *filename, const char *directory) {
+	File f;
+	if (!f.open(filename, directory, "wb")) {
+		warning("Unable to write profile '%s'", filename);
+		return;
+	}
+	char id[16];
+	writeLine(f, "part,kind,id,count,time_us\n");
+	for (int i = 0; i < NUM_PARTS; ++i) {
+		PartStats *ps = &_parts[i];
+		if (ps->frames == 0) {
+			continue;
+		}
+		uint16 ptrsId = 0x3E80 + i;
+		writeLine(f, "0x%X,frames,,%lu,\n", ptrsId, ps->frames);
+		for (int op = 0; op < NUM_CLASSES; ++op) {
+			if (ps->ops[op].count != 0) {
+				if (op == OP_VIDEO_40) {
+					strcpy(id, "video_40");
+				} else if (op == OP_VIDEO_80) {
+					strcpy(id, "video_80");
+				} else {
+					sprintf(id, "0x%02X", op);
+				}
+				writeCounter(f, ptrsId, "opcode", id, &ps->ops[op]);
+			}
+		}
+		for (int slot = 0; slot < NUM_SLOTS; ++slot) {
+			if (ps->slots[slot].count != 0) {
+				sprintf(id, "0x%02X", slot);
+				writeCounter(f, ptrsId, "slot", id, &ps->slots[slot]);
+			}
+		}
+		// hottest offsets first, ranked by time
+		int hot[NUM_HOT_OFFSETS];
+		int numHot = 0;
+		for (int pos = 0; pos < 0x10000; ++pos) {
+			uint64 t = ps->offsets[pos].time;
+			if (ps->offsets[pos].count == 0 || (numHot == NUM_HOT_OFFSETS && t <= ps->offsets[hot[numHot - 1]].time)) {
+				continue;
+			}
+			int j = (numHot < NUM_HOT_OFFSETS) ? numHot++ : numHot - 1;
+			while (j > 0 && ps->offsets[hot[j - 1]].time < t) {
+				hot[j] = hot[j - 1];
+				--j;
+			}
+			hot[j] = pos;
+		}
+		for (int n = 0; n < numHot; ++n) {
+			sprintf(id, "0x%04X", hot[n]);
+			writeCounter(f, ptrsId, "offset", id, &ps->offsets[hot[n]]);
+		}
+	}
+	if (f.ioErr()) {
+		warning("I/O error when writing profile");
+	}
+}
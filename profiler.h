@@ -0,0 +1,88 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "intern.h"
+
+struct Profiler {
+	enum {
+		NUM_PARTS = 10,
+		NUM_SLOTS = 0x40,
+		NUM_HOT_OFFSETS = 32,
+		// 0x00-0x1A are the bytecode opcodes, as numbered by Decoder::DecodedOpcode
+		OP_VIDEO_80 = 0x1B,
+		OP_VIDEO_40 = 0x1C,
+		NUM_CLASSES
+	};
+
+	struct Counter {
+		uint64 count;
+		uint64 time; // nanoseconds
+	};
+
+	struct PartStats {
+		uint32 frames;
+		Counter ops[NUM_CLASSES];
+		Counter slots[NUM_SLOTS];
+		Counter *offsets; // indexed by bytecode offset, allocated on first use
+	};
+
+	PartStats _parts[NUM_PARTS];
+	PartStats *_cur;
+	uint64 _overhead;
+
+	Profiler();
+	~Profiler();
+
+	static uint64 now();
+
+	void setPart(uint16 ptrsId);
+	void addFrame() {
+		if (_cur) {
+			++_cur->frames;
+		}
+	}
+	void addOp(uint16 pos, uint8 opcode, uint64 t) {
+		if (_cur) {
+			uint8 cls = opcode;
+			if (opcode & 0x80) {
+				cls = OP_VIDEO_80;
+			} else if (opcode & 0x40) {
+				cls = OP_VIDEO_40;
+			} else if (opcode >= OP_VIDEO_80) {
+				return;
+			}
+			t = (t > _overhead) ? t - _overhead : 0;
+			++_cur->ops[cls].count;
+			_cur->ops[cls].time += t;
+			++_cur->offsets[pos].count;
+			_cur->offsets[pos].time += t;
+		}
+	}
+	void addSlot(uint8 slot, uint32 count, uint64 t) {
+		if (_cur) {
+			_cur->slots[slot].count += count;
+			_cur->slots[slot].time += t;
+		}
+	}
+	void dump(const char *filename, const char *directory);
+};
+
+#endif
@@ -0,0 +1,288 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include "aot.h"
+#include "profiler.h"
+#include "rendertrace.h"
+#include "resource.h"
+#include "systemstub.h"
+#include "util.h"
+#include "video.h"
+
+
+static const char *USAGE =
+	"Raw - Another World Interpreter, render benchmark\n"
+	"Usage: render_bench --trace=FILE [OPTIONS]...\n"
+	"  --trace=FILE      Render trace recorded with raw --drawtrace\n"
+	"  --tracepath=PATH  Path to where the trace is stored (default '.')\n"
+	"  --hires=SCALE     Draw the polygons at SCALE times 320x200 (default as recorded)\n"
+	"  --drawlists       Defer the drawing until the pages are read\n"
+	"  --drawthreads=N   Number of threads drawing the polygons (default 1)\n"
+	"  --spancache=KB    Memory used to replay the spans of the static shapes (default 0)\n"
+	"  --repeat=N        Number of timed replays, the best is reported (default 5)\n";
+
+#ifdef USE_AOT_SCRIPTS
+// render_bench links the engine objects without the scripts
+const AotPart g_aotParts[] = {
+	{ 0, 0, 0, 0 }
+};
+#endif
+
+// no display nor audio, the threads drawing the bands are kept
+struct BenchStub : SystemStub {
+	struct Thread {
+		ThreadProc proc;
+		void *param;
+		pthread_t thread;
+	};
+
+	static void *threadProc(void *param) {
+		Thread *t = (Thread *)param;
+		t->proc(t->param);
+		return 0;
+	}
+
+	virtual void init(const char *, uint16, uint16) {}
+	virtual void destroy() {}
+	virtual void setPalette(uint8, uint8, const uint8 *) {}
+	virtual void copyRect(uint16, uint16, uint16, uint16, const uint8 *, uint32) {}
+	virtual void copyRects(const Rect *, uint16, const uint8 *, uint32) {}
+	virtual void processEvents() {}
+	virtual void sleep(uint32) {}
+	virtual uint32 getTimeStamp() { return Profiler::now() / 1000000; }
+	virtual void startAudio(AudioCallback, void *) {}
+	virtual void stopAudio() {}
+	virtual uint32 getOutputSampleRate() { return 0; }
+	virtual void *addTimer(uint32, TimerCallback, void *) { return 0; }
+	virtual void removeTimer(void *) {}
+
+	virtual void *createMutex() {
+		pthread_mutex_t *m = new pthread_mutex_t;
+		pthread_mutex_init(m, 0);
+		return m;
+	}
+	virtual void destroyMutex(void *mutex) {
+		pthread_mutex_destroy((pthread_mutex_t *)mutex);
+		delete (pthread_mutex_t *)mutex;
+	}
+	virtual void lockMutex(void *mutex) {
+		pthread_mutex_lock((pthread_mutex_t *)mutex);
+	}
+	virtual void unlockMutex(void *mutex) {
+		pthread_mutex_unlock((pthread_mutex_t *)mutex);
+	}
+
+	virtual void *createThread(ThreadProc proc, void *param) {
+		Thread *t = new Thread;
+		t->proc = proc;
+		t->param = param;
+		pthread_create(&t->thread, 0, threadProc, t);
+		return t;
+	}
+	virtual void waitThread(void *thread) {
+		Thread *t = (Thread *)thread;
+		pthread_join(t->thread, 0);
+		delete t;
+	}
+
+	virtual void *createSemaphore(uint32 value) {
+		sem_t *s = new sem_t;
+		sem_init(s, 0, value);
+		return s;
+	}
+	virtual void destroySemaphore(void *sem) {
+		sem_destroy((sem_t *)sem);
+		delete (sem_t *)sem;
+	}
+	virtual void waitSemaphore(void *sem) {
+		sem_wait((sem_t *)sem);
+	}
+	virtual void postSemaphore(void *sem) {
+		sem_post((sem_t *)sem);
+	}
+};
+
+struct ReplayStats {
+	uint32 frames;
+	uint32 polygons;
+	uint32 mismatches;
+	uint32 firstMismatch;
+};
+
+static bool parseOption(const char *arg, const char *longCmd, const char **opt) {
+	bool ret = false;
+	if (arg[0] == '-' && arg[1] == '-') {
+		if (strncmp(arg + 2, longCmd, strlen(longCmd)) == 0) {
+			*opt = arg + 2 + strlen(longCmd);
+			ret = true;
+		}
+	}
+	return ret;
+}
+
+// the polygons are counted and the pages checked when stats is set
+static void replay(const RenderTrace *rt, Video *vid, Resource *res, ReplayStats *stats) {
+	for (uint32 i = 0; i < rt->_numEvents; ++i) {
+		const RenderTrace::Event *e = &rt->_events[i];
+		switch (e->type) {
+		case RenderTrace::TE_SEGMENTS:
+			// as Resource::setupPtrs()
+			vid->resolveDrawLists();
+			vid->_shapes.invalidate();
+			vid->_spanCache.invalidate();
+			res->_segVideoPal = e->data[0];
+			res->_segVideo1 = e->data[1];
+			res->_segVideo1Size = e->size[1];
+			res->_segVideo2 = e->data[2];
+			res->_segVideo2Size = e->size[2];
+			break;
+		case RenderTrace::TE_SHAPE:
+			vid->setDataBuffer(e->seg ? res->_segVideo2 : res->_segVideo1, e->offset);
+			if (stats) {
+				stats->polygons += vid->getShapeList(e->color, e->zoom)->numShapes;
+			}
+			vid->drawShape(e->color, e->zoom, Point(e->x, e->y));
+			break;
+		case RenderTrace::TE_STRING:
+			vid->drawString(e->color, e->x, e->y, e->offset);
+			break;
+		case RenderTrace::TE_PAGE1:
+			vid->changePagePtr1(e->page);
+			break;
+		case RenderTrace::TE_FILL:
+			vid->fillPage(e->page, e->color);
+			break;
+		case RenderTrace::TE_COPY:
+			vid->copyPage(e->src, e->page, e->y);
+			break;
+		case RenderTrace::TE_UPDATE:
+			vid->_newPal = e->pal;
+			vid->updateDisplay(e->page);
+			if (stats) {
+				if (vid->getPageChecksum(vid->_curPage2) != e->checksum) {
+					if (stats->mismatches == 0) {
+						stats->firstMismatch = stats->frames;
+					}
+					++stats->mismatches;
+				}
+				++stats->frames;
+			}
+			break;
+		case RenderTrace::TE_BACKGROUND:
+		case RenderTrace::TE_CACHED_BACKGROUND:
+			vid->copyPagePtr(e->data[0]);
+			break;
+		case RenderTrace::TE_STATE:
+			vid->_curPal = e->color;
+			vid->_newPal = e->pal;
+			vid->loadPages(e->data[0], e->seg);
+			vid->changePal(vid->_curPal);
+			break;
+		}
+	}
+	vid->resolveDrawLists();
+}
+
+int main(int argc, char *argv[]) {
+	const char *traceFile = 0;
+	const char *tracePath = ".";
+	const char *hires = 0;
+	const char *drawLists = 0;
+	const char *drawThreads = "1";
+	const char *spanCache = "0";
+	const char *repeat = "5";
+	for (int i = 1; i < argc; ++i) {
+		bool opt = false;
+		if (strlen(argv[i]) >= 2) {
+			opt |= parseOption(argv[i], "trace=", &traceFile);
+			opt |= parseOption(argv[i], "tracepath=", &tracePath);
+			opt |= parseOption(argv[i], "hires=", &hires);
+			opt |= parseOption(argv[i], "drawlists", &drawLists);
+			opt |= parseOption(argv[i], "drawthreads=", &drawThreads);
+			opt |= parseOption(argv[i], "spancache=", &spanCache);
+			opt |= parseOption(argv[i], "repeat=", &repeat);
+		}
+		if (!opt) {
+			printf(USAGE);
+			return 0;
+		}
+	}
+	if (!traceFile) {
+		printf(USAGE);
+		return 0;
+	}
+	g_debugMask = DBG_INFO;
+	RenderTrace rt;
+	if (!rt.load(traceFile, tracePath)) {
+		return 1;
+	}
+	uint16 w = rt._w;
+	uint16 h = rt._h;
+	if (hires) {
+		double scale = atof(hires);
+		if (scale < 1.) {
+			scale = 1.;
+		} else if (scale > 8.) {
+			scale = 8.;
+		}
+		w = (uint16)(Video::VID_PAGE_W * scale + .5);
+		h = (uint16)(Video::VID_PAGE_H * scale + .5);
+	}
+	const int numThreads = atoi(drawThreads);
+	BenchStub stub;
+	Resource res(0, ".");
+	Video *vid = new Video(&res, &stub);
+	vid->init(w, h);
+	vid->_spanCache.init(atoi(spanCache) * 1024);
+	vid->initWorkers(numThreads);
+	vid->_deferred = drawLists != 0 || numThreads > 1;
+
+	// the first replay counts the polygons and checks the pages displayed against the recording
+	ReplayStats stats;
+	memset(&stats, 0, sizeof(stats));
+	replay(&rt, vid, &res, &stats);
+	printf("%lu events, %lu frames, %lu polygons, recorded at %dx%d\n", (unsigned long)rt._numEvents, (unsigned long)stats.frames, (unsigned long)stats.polygons, rt._w, rt._h);
+	int ret = 0;
+	if (w != rt._w || h != rt._h) {
+		printf("checksums not compared at %dx%d\n", w, h);
+	} else if (stats.mismatches != 0) {
+		printf("checksums differ in %lu frames, first at frame %lu\n", (unsigned long)stats.mismatches, (unsigned long)stats.firstMismatch);
+		ret = 1;
+	} else {
+		printf("checksums match\n");
+	}
+
+	uint64 best = 0;
+	const int count = MAX(atoi(repeat), 1);
+	for (int i = 0; i < count; ++i) {
+		const uint64 t0 = Profiler::now();
+		replay(&rt, vid, &res, 0);
+		const uint64 t = Profiler::now() - t0;
+		if (i == 0 || t < best) {
+			best = t;
+		}
+	}
+	if (stats.frames != 0 && best != 0) {
+		printf("%dx%d: %.0f ns/frame, %.0f polygons/s (best of %d)\n", w, h, (double)best / stats.frames, stats.polygons * 1e9 / best, count);
+	}
+	vid->freeWorkers();
+	delete vid;
+	return ret;
+}
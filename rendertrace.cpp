@@ -0,0 +1,273 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "rendertrace.h"
+#include "util.h"
+
+
+RenderTrace::RenderTrace()
+	: _f(true), _recording(false), _w(0), _h(0), _events(0), _numEvents(0) {
+}
+
+RenderTrace::~RenderTrace() {
+	close();
+	unload();
+}
+
+bool RenderTrace::open(const char *filename, const char *directory, uint16 w, uint16 h) {
+	if (!_f.open(filename, directory, "wb")) {
+		warning("Unable to open render trace file '%s'", filename);
+		return false;
+	}
+	_f.writeUint32BE('AWRT');
+	_f.writeUint16BE(CUR_VER);
+	_f.writeUint16BE(w);
+	_f.writeUint16BE(h);
+	_recording = true;
+	return true;
+}
+
+void RenderTrace::close() {
+	if (_recording) {
+		_f.writeByte(TE_END);
+		if (_f.ioErr()) {
+			warning("I/O error when writing the render trace");
+		}
+		_f.close();
+		_recording = false;
+	}
+}
+
+void RenderTrace::writeData(const uint8 *p, uint32 size) {
+	_f.writeUint32BE(size);
+	_f.write((void *)p, size);
+}
+
+void RenderTrace::writeSegments(const uint8 *pal, const uint8 *seg1, uint32 size1, const uint8 *seg2, uint32 size2) {
+	_f.writeByte(TE_SEGMENTS);
+	writeData(pal, PAL_SIZE);
+	writeData(seg1, size1);
+	writeData(seg2, size2);
+}
+
+void RenderTrace::writeShape(uint8 seg, uint16 offset, uint8 color, uint16 zoom, const Point &pt) {
+	_f.writeByte(TE_SHAPE);
+	_f.writeByte(seg);
+	_f.writeUint16BE(offset);
+	_f.writeByte(color);
+	_f.writeUint16BE(zoom);
+	_f.writeUint16BE(pt.x);
+	_f.writeUint16BE(pt.y);
+}
+
+void RenderTrace::writeString(uint8 color, uint16 x, uint16 y, uint16 strId) {
+	_f.writeByte(TE_STRING);
+	_f.writeByte(color);
+	_f.writeUint16BE(x);
+	_f.writeUint16BE(y);
+	_f.writeUint16BE(strId);
+}
+
+void RenderTrace::writePage1(uint8 page) {
+	_f.writeByte(TE_PAGE1);
+	_f.writeByte(page);
+}
+
+void RenderTrace::writeFill(uint8 page, uint8 color) {
+	_f.writeByte(TE_FILL);
+	_f.writeByte(page);
+	_f.writeByte(color);
+}
+
+void RenderTrace::writeCopy(uint8 src, uint8 dst, int16 vscroll) {
+	_f.writeByte(TE_COPY);
+	_f.writeByte(src);
+	_f.writeByte(dst);
+	_f.writeUint16BE(vscroll);
+}
+
+void RenderTrace::writeUpdate(uint8 page, uint8 pal, uint32 checksum) {
+	_f.writeByte(TE_UPDATE);
+	_f.writeByte(page);
+	_f.writeByte(pal);
+	_f.writeUint32BE(checksum);
+}
+
+void RenderTrace::writeBackground(const uint8 *src) {
+	_f.writeByte(TE_BACKGROUND);
+	writeData(src, BACKGROUND_SIZE);
+}
+
+void RenderTrace::writeCacheBackground(uint16 resNum) {
+	_f.writeByte(TE_CACHE_BACKGROUND);
+	_f.writeUint16BE(resNum);
+}
+
+void RenderTrace::writeCachedBackground(uint16 resNum) {
+	_f.writeByte(TE_CACHED_BACKGROUND);
+	_f.writeUint16BE(resNum);
+}
+
+void RenderTrace::writeState(uint8 curPal, uint8 newPal, uint8 mask, const uint8 *packed, uint32 size) {
+	_f.writeByte(TE_STATE);
+	_f.writeByte(curPal);
+	_f.writeByte(newPal);
+	_f.writeByte(mask);
+	writeData(packed, size);
+}
+
+bool RenderTrace::load(const char *filename, const char *directory) {
+	unload();
+	if (!_f.open(filename, directory, "rb")) {
+		warning("Unable to open render trace file '%s'", filename);
+		return false;
+	}
+	if (_f.readUint32BE() != 'AWRT' || _f.readUint16BE() != CUR_VER) {
+		warning("Bad render trace format");
+		_f.close();
+		return false;
+	}
+	_w = _f.readUint16BE();
+	_h = _f.readUint16BE();
+	// the backgrounds cached, the hits point to their data
+	struct {
+		uint16 resNum;
+		uint8 *data;
+	} cached[MAX_CACHED_BACKGROUNDS];
+	int numCached = 0;
+	uint8 *lastBackground = 0;
+	uint32 maxEvents = 0;
+	bool done = false;
+	while (!done) {
+		const uint8 type = _f.readByte();
+		if (_f.ioErr()) {
+			warning("Render trace truncated after %d events", _numEvents);
+			break;
+		}
+		if (_numEvents == maxEvents) {
+			maxEvents = maxEvents ? maxEvents * 2 : 4096;
+			_events = (Event *)realloc(_events, maxEvents * sizeof(Event));
+		}
+		Event *e = &_events[_numEvents];
+		memset(e, 0, sizeof(Event));
+		e->type = type;
+		switch (type) {
+		case TE_END:
+			done = true;
+			continue;
+		case TE_SEGMENTS:
+			e->data[0] = readData(&e->size[0], PAL_SIZE);
+			e->data[1] = readData(&e->size[1], 0);
+			e->data[2] = readData(&e->size[2], 0);
+			break;
+		case TE_SHAPE:
+			e->seg = _f.readByte();
+			e->offset = _f.readUint16BE();
+			e->color = _f.readByte();
+			e->zoom = _f.readUint16BE();
+			e->x = _f.readUint16BE();
+			e->y = _f.readUint16BE();
+			break;
+		case TE_STRING:
+			e->color = _f.readByte();
+			e->x = _f.readUint16BE();
+			e->y = _f.readUint16BE();
+			e->offset = _f.readUint16BE();
+			break;
+		case TE_PAGE1:
+			e->page = _f.readByte();
+			break;
+		case TE_FILL:
+			e->page = _f.readByte();
+			e->color = _f.readByte();
+			break;
+		case TE_COPY:
+			e->src = _f.readByte();
+			e->page = _f.readByte();
+			e->y = _f.readUint16BE();
+			break;
+		case TE_UPDATE:
+			e->page = _f.readByte();
+			e->pal = _f.readByte();
+			e->checksum = _f.readUint32BE();
+			break;
+		case TE_BACKGROUND:
+			e->data[0] = lastBackground = readData(&e->size[0], BACKGROUND_SIZE);
+			break;
+		case TE_CACHE_BACKGROUND:
+			e->offset = _f.readUint16BE();
+			if (numCached < MAX_CACHED_BACKGROUNDS) {
+				cached[numCached].resNum = e->offset;
+				cached[numCached].data = lastBackground;
+				++numCached;
+			}
+			continue;
+		case TE_CACHED_BACKGROUND:
+			e->offset = _f.readUint16BE();
+			for (int i = numCached - 1; i >= 0; --i) {
+				if (cached[i].resNum == e->offset) {
+					e->data[0] = cached[i].data;
+					break;
+				}
+			}
+			if (!e->data[0]) {
+				warning("RenderTrace::load() background %d not cached", e->offset);
+				continue;
+			}
+			break;
+		case TE_STATE:
+			e->color = _f.readByte();
+			e->pal = _f.readByte();
+			e->seg = _f.readByte();
+			e->data[0] = readData(&e->size[0], 0);
+			break;
+		default:
+			warning("RenderTrace::load() unknown event %d", type);
+			done = true;
+			continue;
+		}
+		++_numEvents;
+	}
+	if (_f.ioErr()) {
+		warning("I/O error when reading the render trace");
+	}
+	_f.close();
+	return true;
+}
+
+// the buffer is zero padded up to minSize
+uint8 *RenderTrace::readData(uint32 *size, uint32 minSize) {
+	*size = _f.readUint32BE();
+	uint8 *p = (uint8 *)calloc(MAX(*size, minSize), 1);
+	_f.read(p, *size);
+	return p;
+}
+
+void RenderTrace::unload() {
+	for (uint32 i = 0; i < _numEvents; ++i) {
+		Event *e = &_events[i];
+		if (e->type != TE_CACHED_BACKGROUND) {
+			for (int j = 0; j < 3; ++j) {
+				free(e->data[j]);
+			}
+		}
+	}
+	free(_events);
+	_events = 0;
+	_numEvents = 0;
+}
@@ -0,0 +1,98 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __RENDERTRACE_H__
+#define __RENDERTRACE_H__
+
+#include "intern.h"
+#include "file.h"
+
+// the calls made to Video during a game session, render_bench replays them
+// without the scripts. The file is gzipped, each event is a type byte
+// followed by its big endian arguments.
+struct RenderTrace {
+	enum {
+		CUR_VER = 1
+	};
+
+	enum {
+		TE_END,
+		TE_SEGMENTS, // palettes and shapes of a part
+		TE_SHAPE, // setDataBuffer() and drawShape()
+		TE_STRING,
+		TE_PAGE1, // changePagePtr1()
+		TE_FILL,
+		TE_COPY,
+		TE_UPDATE, // updateDisplay(), ends a frame
+		TE_BACKGROUND, // copyPagePtr()
+		TE_CACHE_BACKGROUND, // cachePage()
+		TE_CACHED_BACKGROUND, // loadCachedPage() hit, replayed as the background cached
+		TE_STATE // pages of a loaded game state
+	};
+
+	enum {
+		PAL_SIZE = 2048,
+		BACKGROUND_SIZE = 32000,
+		MAX_CACHED_BACKGROUNDS = 64
+	};
+
+	struct Event {
+		uint8 type;
+		uint8 page; // TE_PAGE1, TE_FILL, TE_UPDATE, TE_COPY destination
+		uint8 src; // TE_COPY
+		uint8 color; // TE_SHAPE, TE_STRING, TE_FILL, TE_STATE current palette
+		uint8 pal; // TE_UPDATE and TE_STATE palette requested
+		uint8 seg; // TE_SHAPE 1 for the second video segment, TE_STATE pages mask
+		uint16 offset; // TE_SHAPE offset in the segment, TE_STRING id
+		uint16 zoom;
+		int16 x, y; // TE_COPY scroll in y
+		uint32 checksum; // TE_UPDATE page displayed
+		uint8 *data[3]; // TE_SEGMENTS palettes and segments, TE_BACKGROUND bitplanes, TE_STATE packed pages
+		uint32 size[3];
+	};
+
+	File _f;
+	bool _recording;
+	uint16 _w, _h; // page size of the recording
+	Event *_events;
+	uint32 _numEvents;
+
+	RenderTrace();
+	~RenderTrace();
+
+	bool open(const char *filename, const char *directory, uint16 w, uint16 h);
+	void close();
+	void writeData(const uint8 *p, uint32 size);
+	void writeSegments(const uint8 *pal, const uint8 *seg1, uint32 size1, const uint8 *seg2, uint32 size2);
+	void writeShape(uint8 seg, uint16 offset, uint8 color, uint16 zoom, const Point &pt);
+	void writeString(uint8 color, uint16 x, uint16 y, uint16 strId);
+	void writePage1(uint8 page);
+	void writeFill(uint8 page, uint8 color);
+	void writeCopy(uint8 src, uint8 dst, int16 vscroll);
+	void writeUpdate(uint8 page, uint8 pal, uint32 checksum);
+	void writeBackground(const uint8 *src);
+	void writeCacheBackground(uint16 resNum);
+	void writeCachedBackground(uint16 resNum);
+	void writeState(uint8 curPal, uint8 newPal, uint8 mask, const uint8 *packed, uint32 size);
+
+	bool load(const char *filename, const char *directory);
+	uint8 *readData(uint32 *size, uint32 minSize);
+	void unload();
+};
+
+#endif
@@ -19,12 +19,13 @@
 #include "resource.h"
 #include "bank.h"
 #include "file.h"
+#include "rendertrace.h"
 #include "serializer.h"
 #include "video.h"
 
 
 Resource::Resource(Video *vid, const char *dataDir) 
-	: _vid(vid), _dataDir(dataDir) {
+	: _vid(vid), _dataDir(dataDir), _segVideo1Size(0), _segVideo2Size(0), _segCodeVerified(false) {
 }
 
 void Resource::readBank(const MemEntry *me, uint8 *dstBuf) {
@@ -95,6 +96,10 @@ void Resource::load() {
 
 		uint8 *memPtr = 0;
 		if (me->type == 2) {
+			if (_vid && _vid->loadCachedPage(me - _memList)) {
+				me->valid = 0;
+				continue;
+			}
 			memPtr = _vidCurPtr;
 		} else {
 			memPtr = _scriptCurPtr;
@@ -111,7 +116,10 @@ void Resource::load() {
 			debug(DBG_BANK, "Resource::load() bufPos=%X size=%X type=%X pos=%X bankNum=%X", memPtr - _memPtrStart, me->packedSize, me->type, me->bankPos, me->bankNum);
 			readBank(me, memPtr);
 			if(me->type == 2) {
-				_vid->copyPagePtr(_vidCurPtr);
+				if (_vid) {
+					_vid->copyPagePtr(_vidCurPtr);
+					_vid->cachePage(me - _memList);
+				}
 				me->valid = 0;
 			} else {
 				me->bufPtr = memPtr;
@@ -171,6 +179,7 @@ void Resource::setupPtrs(uint16 ptrId) {
 		} else {
 			error("Resource::setupPtrs() ec=0x%X invalid ptrId", 0xF07);
 		}
+		invalidateVideo();
 		invalidateAll();
 		_memList[ipal].valid = 2;
 		_memList[icod].valid = 2;
@@ -181,15 +190,57 @@ void Resource::setupPtrs(uint16 ptrId) {
 		load();
 		_segVideoPal = _memList[ipal].bufPtr;
 		_segCode = _memList[icod].bufPtr;
+		_segCodeSize = _memList[icod].unpackedSize;
 		_segVideo1 = _memList[ivd1].bufPtr;
+		_segVideo1Size = _memList[ivd1].unpackedSize;
+		_segVideo2Size = 0;
 		if (ivd2 != 0) {
 			_segVideo2 = _memList[ivd2].bufPtr;
+			_segVideo2Size = _memList[ivd2].unpackedSize;
 		}
 		_curPtrsId = ptrId;
+		verifyCode();
+		traceSegments();
 	}
 	_scriptBakPtr = _scriptCurPtr;	
 }
 
+// the drawing pending on the segments is done and what was cached from them
+// dropped before they are replaced, aotgen loads the parts without a Video
+void Resource::invalidateVideo() {
+	if (_vid) {
+		_vid->resolveDrawLists();
+		_vid->_shapes.invalidate();
+		_vid->_spanCache.invalidate();
+	}
+}
+
+// the shapes and palettes drawn by the part, for the render traces
+void Resource::traceSegments() {
+	if (_vid && _vid->_trace) {
+		_vid->_trace->writeSegments(_segVideoPal, _segVideo1, _segVideo1Size, _segVideo2, _segVideo2Size);
+	}
+}
+
+void Resource::verifyCode() {
+	_cache.open(_segCode, _segCodeSize);
+	uint32 size;
+	const Verifier::Result *vr = (const Verifier::Result *)_cache.find('VRFY', &size);
+	if (vr && size == sizeof(Verifier::Result) && vr->video1Size == _segVideo1Size && vr->video2Size == _segVideo2Size) {
+		_segCodeVerified = vr->verified != 0;
+		memcpy(_verifier._entries, vr->entries, sizeof(vr->entries));
+	} else {
+		_segCodeVerified = _verifier.verify(_segCode, _segCodeSize, _segVideo1Size, _segVideo2Size);
+		Verifier::Result r;
+		r.video1Size = _segVideo1Size;
+		r.video2Size = _segVideo2Size;
+		r.verified = _segCodeVerified;
+		memcpy(r.entries, _verifier._entries, sizeof(r.entries));
+		_cache.add('VRFY', &r, sizeof(r));
+	}
+	debug(DBG_INFO, "Resource::verifyCode() ptrsId=0x%X verified=%d", _curPtrsId, _segCodeVerified);
+}
+
 void Resource::allocMemBlock() {
 	_memPtrStart = (uint8 *)malloc(MEM_BLOCK_SIZE);
 	_scriptBakPtr = _scriptCurPtr = _memPtrStart;
@@ -242,14 +293,28 @@ void Resource::saveOrLoad(Serializer &ser) {
 	};
 	ser.saveOrLoadEntries(entries);
 	if (ser._mode == Serializer::SM_LOAD) {
+		// the segments are read over, as in setupPtrs()
+		invalidateVideo();
 		uint8 *p = loadedList;
 		uint8 *q = _memPtrStart;
+		_segVideo1Size = _segVideo2Size = 0;
 		while (*p) {
 			MemEntry *me = &_memList[*p++];
 			readBank(me, q);
 			me->bufPtr = q;
 			me->valid = 1;
+			if (q == _segCode) {
+				_segCodeSize = me->unpackedSize;
+			}
+			if (q == _segVideo1) {
+				_segVideo1Size = me->unpackedSize;
+			}
+			if (q == _segVideo2) {
+				_segVideo2Size = me->unpackedSize;
+			}
 			q += me->unpackedSize;
 		}
+		verifyCode();
+		traceSegments();
 	}	
 }
@@ -20,6 +20,8 @@
 #define __RESOURCE_H__
 
 #include "intern.h"
+#include "codecache.h"
+#include "verifier.h"
 
 struct MemEntry {
 	uint8 valid;         // 0x0
@@ -63,8 +65,14 @@ struct Resource {
 	bool _useSegVideo2;
 	uint8 *_segVideoPal;
 	uint8 *_segCode;
+	uint16 _segCodeSize;
 	uint8 *_segVideo1;
+	uint16 _segVideo1Size;
 	uint8 *_segVideo2;
+	uint16 _segVideo2Size;
+	Verifier _verifier;
+	bool _segCodeVerified;
+	CodeCache _cache;
 
 	Resource(Video *vid, const char *dataDir);
 	
@@ -75,6 +83,9 @@ struct Resource {
 	void invalidateRes();	
 	void update(uint16 num);
 	void setupPtrs(uint16 ptrId);
+	void invalidateVideo();
+	void traceSegments();
+	void verifyCode();
 	void allocMemBlock();
 	void freeMemBlock();
 	
@@ -0,0 +1,259 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "scriptdeps.h"
+
+
+static inline void setVar(uint8 *set, uint8 var) {
+	set[var >> 3] |= 1 << (var & 7);
+}
+
+ScriptDeps::ScriptDeps()
+	: _numSummaries(0), _visited(0), _stack(0) {
+	_summaries = (Summary *)malloc(MAX_SUMMARIES * sizeof(Summary));
+	_summaryMap = (uint16 *)malloc(0x10000 * sizeof(uint16));
+	if (!_summaries || !_summaryMap) {
+		error("ScriptDeps::ScriptDeps() unable to allocate summaries");
+	}
+	memset(_summaryMap, 0xFF, 0x10000 * sizeof(uint16));
+}
+
+ScriptDeps::~ScriptDeps() {
+	free(_stack);
+	free(_visited);
+	free(_summaryMap);
+	free(_summaries);
+}
+
+void ScriptDeps::setup(const uint8 *seg, uint16 segSize, uint16 ptrsId) {
+	_dec.setup(seg, segSize, ptrsId);
+	free(_visited);
+	free(_stack);
+	_visited = (uint8 *)malloc(_dec._maxOps);
+	// every visited op pushes at most two successors
+	_stack = (uint16 *)malloc((_dec._maxOps * 2 + 1) * sizeof(uint16));
+	if (!_visited || !_stack) {
+		error("ScriptDeps::setup() unable to allocate %d ops", _dec._maxOps);
+	}
+	_numSummaries = 0;
+	memset(_summaryMap, 0xFF, 0x10000 * sizeof(uint16));
+}
+
+const ScriptDeps::Summary *ScriptDeps::lookup(uint16 pos) {
+	uint16 i = _summaryMap[pos];
+	if (i == NO_SUMMARY) {
+		if (_numSummaries == MAX_SUMMARIES) {
+			return 0;
+		}
+		i = _numSummaries++;
+		analyze(pos, &_summaries[i]);
+		_summaryMap[pos] = i;
+	}
+	return &_summaries[i];
+}
+
+void ScriptDeps::analyze(uint16 pos, Summary *s) {
+	s->pure = false;
+	memset(s->reads, 0, sizeof(s->reads));
+	memset(s->writes, 0, sizeof(s->writes));
+	if (pos >= _dec._segSize) {
+		return;
+	}
+	memset(_visited, 0, _dec._maxOps);
+	int sp = 0;
+	_stack[sp++] = _dec.lookup(pos);
+	while (sp != 0) {
+		uint16 i = _stack[--sp];
+		if (_visited[i]) {
+			continue;
+		}
+		_visited[i] = 1;
+		const DecodedOp *op = &_dec._ops[i];
+		bool next = true;
+		switch (op->opcode) {
+		case 0x00: // op_movConst
+			setVar(s->writes, op->args[0]);
+			break;
+		case 0x01: // op_mov
+			setVar(s->writes, op->args[0]);
+			setVar(s->reads, op->args[1]);
+			break;
+		case 0x02: // op_add
+		case 0x13: // op_sub
+			setVar(s->reads, op->args[0]);
+			setVar(s->writes, op->args[0]);
+			setVar(s->reads, op->args[1]);
+			break;
+		case 0x03: // op_addConst
+		case 0x14: // op_and
+		case 0x15: // op_or
+		case 0x16: // op_shl
+		case 0x17: // op_shr
+			setVar(s->reads, op->args[0]);
+			setVar(s->writes, op->args[0]);
+			break;
+		case 0x04: // op_call, returns to the next op
+			_stack[sp++] = op->target;
+			break;
+		case 0x05: // op_ret
+		case 0x06: // op_break
+		case 0x11: // op_halt
+			next = false;
+			break;
+		case 0x07: // op_jmp
+		case Decoder::DOP_GOTO:
+			_stack[sp++] = op->target;
+			next = false;
+			break;
+		case 0x09: // op_jnz
+			setVar(s->reads, op->args[0]);
+			setVar(s->writes, op->args[0]);
+			_stack[sp++] = op->target;
+			break;
+		case 0x0A: // op_condJmp
+			setVar(s->reads, op->args[0]);
+			if (op->flags & Decoder::DF_COND_VAR) {
+				setVar(s->reads, op->args[1]);
+			}
+			_stack[sp++] = op->target;
+			break;
+		default:
+			// slots, video, sound and resources are only touched sequentially
+			return;
+		}
+		if (next) {
+			_stack[sp++] = i + 1;
+		}
+	}
+	s->pure = true;
+}
+
+void ScriptDeps::execute(int16 *vars, ScriptContext *ctx) const {
+	const DecodedOp *ops = _dec._ops;
+	const DecodedOp *op = ops + _dec._offsetMap[ctx->pos];
+	while (1) {
+		switch (op->opcode) {
+		case 0x00: // op_movConst
+			vars[op->args[0]] = op->args[1];
+			++op;
+			break;
+		case 0x01: // op_mov
+			vars[op->args[0]] = vars[op->args[1]];
+			++op;
+			break;
+		case 0x02: // op_add
+			vars[op->args[0]] += vars[op->args[1]];
+			++op;
+			break;
+		case 0x03: // op_addConst
+			vars[op->args[0]] += (int16)op->args[1];
+			++op;
+			break;
+		case 0x04: // op_call
+			ctx->stackCalls[ctx->stackPtr] = op->next;
+			if (ctx->stackPtr == 0xFF) {
+				error("Logic::op_call() ec=0x%X stack overflow", 0x8F);
+			}
+			++ctx->stackPtr;
+			op = ops + op->target;
+			break;
+		case 0x05: { // op_ret
+				if (ctx->stackPtr == 0) {
+					error("Logic::op_ret() ec=0x%X stack underflow", 0x8F);
+				}
+				--ctx->stackPtr;
+				uint16 i = _dec._offsetMap[ctx->stackCalls[ctx->stackPtr]];
+				if (i == Decoder::NO_INDEX) {
+					error("ScriptDeps::execute() ret to undecoded offset 0x%X", ctx->stackCalls[ctx->stackPtr]);
+				}
+				op = ops + i;
+			}
+			break;
+		case 0x06: // op_break
+			ctx->pos = op->next;
+			return;
+		case 0x07: // op_jmp
+		case Decoder::DOP_GOTO:
+			op = ops + op->target;
+			break;
+		case 0x09: // op_jnz
+			--vars[op->args[0]];
+			if (vars[op->args[0]] != 0) {
+				op = ops + op->target;
+			} else {
+				++op;
+			}
+			break;
+		case 0x0A: { // op_condJmp
+				int16 b = vars[op->args[0]];
+				int16 a = op->args[1];
+				if (op->flags & Decoder::DF_COND_VAR) {
+					a = vars[a];
+				}
+				if (Decoder::evalCond(op->flags & Decoder::DF_COND_MASK, b, a)) {
+					op = ops + op->target;
+				} else {
+					++op;
+				}
+			}
+			break;
+		case 0x11: // op_halt
+			ctx->pos = 0xFFFF;
+			return;
+		case 0x13: // op_sub
+			vars[op->args[0]] -= vars[op->args[1]];
+			++op;
+			break;
+		case 0x14: // op_and
+			vars[op->args[0]] = (uint16)vars[op->args[0]] & op->args[1];
+			++op;
+			break;
+		case 0x15: // op_or
+			vars[op->args[0]] = (uint16)vars[op->args[0]] | op->args[1];
+			++op;
+			break;
+		case 0x16: // op_shl
+			vars[op->args[0]] = (uint16)vars[op->args[0]] << op->args[1];
+			++op;
+			break;
+		case 0x17: // op_shr
+			vars[op->args[0]] = (uint16)vars[op->args[0]] >> op->args[1];
+			++op;
+			break;
+		default:
+			error("ScriptDeps::execute() ec=0x%X unexpected opcode=0x%X", 0xFFF, op->opcode);
+			break;
+		}
+	}
+}
+
+bool ScriptDeps::conflicts(const Summary *s, const uint8 *reads, const uint8 *writes) {
+	for (int i = 0; i < 0x100 / 8; ++i) {
+		if ((s->writes[i] & (reads[i] | writes[i])) || (s->reads[i] & writes[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ScriptDeps::merge(const Summary *s, uint8 *reads, uint8 *writes) {
+	for (int i = 0; i < 0x100 / 8; ++i) {
+		reads[i] |= s->reads[i];
+		writes[i] |= s->writes[i];
+	}
+}
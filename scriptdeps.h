@@ -0,0 +1,64 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __SCRIPTDEPS_H__
+#define __SCRIPTDEPS_H__
+
+#include "intern.h"
+#include "decoder.h"
+
+struct ScriptContext {
+	uint16 pos;
+	uint8 stackPtr;
+	uint16 stackCalls[0x100];
+};
+
+// variables read and written by the code a slot can run until its next
+// op_break, and whether it can reach an opcode with other side effects
+struct ScriptDeps {
+	enum {
+		MAX_SUMMARIES = 1024,
+		NO_SUMMARY = 0xFFFF
+	};
+
+	struct Summary {
+		bool pure;
+		uint8 reads[0x100 / 8];
+		uint8 writes[0x100 / 8];
+	};
+
+	Decoder _dec;
+	Summary *_summaries;
+	uint16 _numSummaries;
+	uint16 *_summaryMap;
+	uint8 *_visited;
+	uint16 *_stack;
+
+	ScriptDeps();
+	~ScriptDeps();
+
+	void setup(const uint8 *seg, uint16 segSize, uint16 ptrsId);
+	const Summary *lookup(uint16 pos);
+	void analyze(uint16 pos, Summary *s);
+	void execute(int16 *vars, ScriptContext *ctx) const;
+
+	static bool conflicts(const Summary *s, const uint8 *reads, const uint8 *writes);
+	static void merge(const Summary *s, uint8 *reads, uint8 *writes);
+};
+
+#endif
@@ -27,6 +27,7 @@ struct SDLStub : SystemStub {
 	enum {
 		SCREEN_W = 320,
 		SCREEN_H = 200,
+		MAX_RECTS = 256,
 		SOUND_SAMPLE_RATE = 22050
 	};
 
@@ -38,18 +39,21 @@ struct SDLStub : SystemStub {
 	
 	static const Scaler _scalers[];
 
+	uint16 _screenW, _screenH;
 	uint8 *_offscreen;
 	SDL_Surface *_screen;
 	SDL_Surface *_sclscreen;
 	bool _fullscreen;
 	uint8 _scaler;
 	uint16 _pal[16];
+	bool _fullUpdate; // the screen does not match the last copied buffer
 
 	virtual ~SDLStub() {}
-	virtual void init(const char *title);
+	virtual void init(const char *title, uint16 w, uint16 h);
 	virtual void destroy();
 	virtual void setPalette(uint8 s, uint8 n, const uint8 *buf);
 	virtual void copyRect(uint16 x, uint16 y, uint16 w, uint16 h, const uint8 *buf, uint32 pitch);
+	virtual void copyRects(const Rect *rects, uint16 count, const uint8 *buf, uint32 pitch);
 	virtual void processEvents();
 	virtual void sleep(uint32 duration);
 	virtual uint32 getTimeStamp();
@@ -62,6 +66,12 @@ struct SDLStub : SystemStub {
 	virtual void destroyMutex(void *mutex);
 	virtual void lockMutex(void *mutex);
 	virtual void unlockMutex(void *mutex);
+	virtual void *createThread(ThreadProc proc, void *param);
+	virtual void waitThread(void *thread);
+	virtual void *createSemaphore(uint32 value);
+	virtual void destroySemaphore(void *sem);
+	virtual void waitSemaphore(void *sem);
+	virtual void postSemaphore(void *sem);
 
 	void prepareGfxMode();
 	void cleanupGfxMode();
@@ -72,7 +82,7 @@ struct SDLStub : SystemStub {
 	void point3x(uint16 *dst, uint16 dstPitch, const uint16 *src, uint16 srcPitch, uint16 w, uint16 h);
 	void scale2x(uint16 *dst, uint16 dstPitch, const uint16 *src, uint16 srcPitch, uint16 w, uint16 h);
 	void scale3x(uint16 *dst, uint16 dstPitch, const uint16 *src, uint16 srcPitch, uint16 w, uint16 h);
-	
+	
 };
 
 const SDLStub::Scaler SDLStub::_scalers[] = {
@@ -82,24 +92,28 @@ const SDLStub::Scaler SDLStub::_scalers[] = {
 	{ "Point3x", &SDLStub::point3x, 3 },
 	{ "Scale3x", &SDLStub::scale3x, 3 }
 };
-
+
 
 SystemStub *SystemStub_SDL_create() {
 	return new SDLStub();
 }
 
-void SDLStub::init(const char *title) {
+void SDLStub::init(const char *title, uint16 w, uint16 h) {
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
 	SDL_EnableKeyRepeat(SDL_DEFAULT_REPEAT_DELAY, SDL_DEFAULT_REPEAT_INTERVAL);
 	SDL_ShowCursor(SDL_DISABLE);
 	SDL_WM_SetCaption(title, NULL);
 	memset(&_pi, 0, sizeof(_pi));
-	_offscreen = (uint8 *)malloc(SCREEN_W * SCREEN_H * 2);
+	_screenW = w;
+	_screenH = h;
+	_offscreen = (uint8 *)malloc(_screenW * _screenH * 2);
 	if (!_offscreen) {
 		error("Unable to allocate offscreen buffer");
 	}
 	_fullscreen = false;
-	_scaler = 1;
+	// the pages are already drawn at the output resolution
+	_scaler = (w == SCREEN_W && h == SCREEN_H) ? 1 : 0;
+	_fullUpdate = true;
 	prepareGfxMode();
 }
 
@@ -124,20 +138,64 @@ void SDLStub::copyRect(uint16 x, uint16 y, uint16 w, uint16 h, const uint8 *buf,
 	buf += y * pitch + x;
 	uint16 *p = (uint16 *)_offscreen;
 	while (h--) {
-		for (int i = 0; i < w / 2; ++i) {
-			uint8 p1 = *(buf + i) >> 4;
-			uint8 p2 = *(buf + i) & 0xF;
-			*(p + i * 2 + 0) = _pal[p1];
-			*(p + i * 2 + 1) = _pal[p2];
+		for (int i = 0; i < w; ++i) {
+			*(p + i) = _pal[*(buf + i)];
 		}
-		p += SCREEN_W;
+		p += _screenW;
 		buf += pitch;
 	}
 	SDL_LockSurface(_sclscreen);
-	(this->*_scalers[_scaler].proc)((uint16 *)_sclscreen->pixels, _sclscreen->pitch, (uint16 *)_offscreen, SCREEN_W, SCREEN_W, SCREEN_H);
+	(this->*_scalers[_scaler].proc)((uint16 *)_sclscreen->pixels, _sclscreen->pitch, (uint16 *)_offscreen, _screenW, _screenW, _screenH);
 	SDL_UnlockSurface(_sclscreen);
 	SDL_BlitSurface(_sclscreen, NULL, _screen, NULL);
 	SDL_UpdateRect(_screen, 0, 0, 0, 0);
+	_fullUpdate = false;
+}
+
+void SDLStub::copyRects(const Rect *rects, uint16 count, const uint8 *buf, uint32 pitch) {
+	if (_fullUpdate || count > MAX_RECTS) {
+		copyRect(0, 0, _screenW, _screenH, buf, pitch);
+		return;
+	}
+	if (count == 0) {
+		return;
+	}
+	for (int n = 0; n < count; ++n) {
+		const Rect *r = &rects[n];
+		const uint8 *src = buf + r->y * pitch + r->x;
+		uint16 *p = (uint16 *)_offscreen + r->y * _screenW + r->x;
+		for (int h = r->h; h--; ) {
+			for (int i = 0; i < r->w; ++i) {
+				*(p + i) = _pal[*(src + i)];
+			}
+			p += _screenW;
+			src += pitch;
+		}
+	}
+	// the scalers read the neighbour pixels, the rectangles are grown by one pixel
+	const uint8 f = _scalers[_scaler].factor;
+	SDL_Rect sdlRects[MAX_RECTS];
+	SDL_LockSurface(_sclscreen);
+	for (int n = 0; n < count; ++n) {
+		const Rect *r = &rects[n];
+		int x1 = MAX(r->x - 1, 0);
+		int y1 = MAX(r->y - 1, 0);
+		int x2 = MIN(r->x + r->w + 1, (int)_screenW);
+		int y2 = MIN(r->y + r->h + 1, (int)_screenH);
+		uint16 *dst = (uint16 *)((uint8 *)_sclscreen->pixels + y1 * f * _sclscreen->pitch) + x1 * f;
+		const uint16 *src = (const uint16 *)_offscreen + y1 * _screenW + x1;
+		(this->*_scalers[_scaler].proc)(dst, _sclscreen->pitch, src, _screenW, x2 - x1, y2 - y1);
+		sdlRects[n].x = x1 * f;
+		sdlRects[n].y = y1 * f;
+		sdlRects[n].w = (x2 - x1) * f;
+		sdlRects[n].h = (y2 - y1) * f;
+	}
+	SDL_UnlockSurface(_sclscreen);
+	for (int n = 0; n < count; ++n) {
+		SDL_Rect dr = sdlRects[n];
+		SDL_BlitSurface(_sclscreen, &sdlRects[n], _screen, &dr);
+	}
+	SDL_UpdateRects(_screen, count, sdlRects);
 }
 
 void SDLStub::processEvents() {
@@ -175,7 +233,7 @@ void SDLStub::processEvents() {
 					switchGfxMode(!_fullscreen, _scaler);
 				} else if (ev.key.keysym.sym == SDLK_KP_PLUS) {
 					uint8 s = _scaler + 1;
-					if (s < ARRAYSIZE(_scalers)) {
+					if (s < ARRAYSIZE(_scalers) && _screenW == SCREEN_W && _screenH == SCREEN_H) {
 						switchGfxMode(_fullscreen, s);
 					}
 				} else if (ev.key.keysym.sym == SDLK_KP_MINUS) {
@@ -292,9 +350,33 @@ void SDLStub::unlockMutex(void *mutex) {
 	SDL_mutexV((SDL_mutex *)mutex);
 }
 
+void *SDLStub::createThread(ThreadProc proc, void *param) {
+	return SDL_CreateThread(proc, param);
+}
+
+void SDLStub::waitThread(void *thread) {
+	SDL_WaitThread((SDL_Thread *)thread, 0);
+}
+
+void *SDLStub::createSemaphore(uint32 value) {
+	return SDL_CreateSemaphore(value);
+}
+
+void SDLStub::destroySemaphore(void *sem) {
+	SDL_DestroySemaphore((SDL_sem *)sem);
+}
+
+void SDLStub::waitSemaphore(void *sem) {
+	SDL_SemWait((SDL_sem *)sem);
+}
+
+void SDLStub::postSemaphore(void *sem) {
+	SDL_SemPost((SDL_sem *)sem);
+}
+
 void SDLStub::prepareGfxMode() {
-	int w = SCREEN_W * _scalers[_scaler].factor;
-	int h = SCREEN_H * _scalers[_scaler].factor;
+	int w = _screenW * _scalers[_scaler].factor;
+	int h = _screenH * _scalers[_scaler].factor;
 	_screen = SDL_SetVideoMode(w, h, 16, _fullscreen ? (SDL_FULLSCREEN | SDL_HWSURFACE) : SDL_HWSURFACE);
 	if (!_screen) {
 		error("SDLStub::prepareGfxMode() unable to allocate _screen buffer");
@@ -332,6 +414,7 @@ void SDLStub::switchGfxMode(bool fullscreen, uint8 scaler) {
 	prepareGfxMode();
 	SDL_BlitSurface(prev_sclscreen, NULL, _sclscreen, NULL);
 	SDL_FreeSurface(prev_sclscreen);
+	_fullUpdate = true;
 }
 
 void SDLStub::point1x(uint16 *dst, uint16 dstPitch, const uint16 *src, uint16 srcPitch, uint16 w, uint16 h) {
@@ -339,7 +422,7 @@ void SDLStub::point1x(uint16 *dst, uint16 dstPitch, const uint16 *src, uint16 sr
 	while (h--) {
 		memcpy(dst, src, w * 2);
 		dst += dstPitch;
-		src += dstPitch;
+		src += srcPitch;
 	}
 }
 
@@ -379,7 +462,7 @@ void SDLStub::point3x(uint16 *dst, uint16 dstPitch, const uint16 *src, uint16 sr
 		src += srcPitch;
 	}
 }
-
+
 void SDLStub::scale2x(uint16 *dst, uint16 dstPitch, const uint16 *src, uint16 srcPitch, uint16 w, uint16 h) {
 	dstPitch >>= 1;
 	while (h--) {
@@ -0,0 +1,135 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "shapecache.h"
+#include "video.h"
+
+
+ShapeCache::ShapeCache()
+	: _numLists(0), _useCounter(0) {
+	memset(_lists, 0, sizeof(_lists));
+	memset(_buckets, 0xFF, sizeof(_buckets));
+}
+
+ShapeCache::~ShapeCache() {
+	for (int i = 0; i < MAX_LISTS; ++i) {
+		free(_lists[i].shapes);
+		free(_lists[i].points);
+	}
+}
+
+// the buffers of the lists are kept for the next ones
+void ShapeCache::invalidate() {
+	debug(DBG_VIDEO, "ShapeCache::invalidate() %d lists", _numLists);
+	_numLists = 0;
+	memset(_buckets, 0xFF, sizeof(_buckets));
+}
+
+const ShapeCache::List *ShapeCache::find(const uint8 *dataBuf, uint16 offset, uint16 zoom, uint8 color) {
+	uint16 num = _buckets[getHash(dataBuf, offset, zoom, color)];
+	while (num != NO_LIST) {
+		List *l = &_lists[num];
+		if (l->dataBuf == dataBuf && l->offset == offset && l->zoom == zoom && l->color == color) {
+			l->lastUse = ++_useCounter;
+			return l;
+		}
+		num = l->hashNext;
+	}
+	return 0;
+}
+
+ShapeCache::List *ShapeCache::add(const uint8 *dataBuf, uint16 offset, uint16 zoom, uint8 color) {
+	uint16 num;
+	if (_numLists < MAX_LISTS) {
+		num = _numLists++;
+	} else {
+		num = 0;
+		for (int i = 1; i < MAX_LISTS; ++i) {
+			if (_lists[i].lastUse < _lists[num].lastUse) {
+				num = i;
+			}
+		}
+		unlink(num);
+	}
+	List *l = &_lists[num];
+	l->dataBuf = dataBuf;
+	l->offset = offset;
+	l->zoom = zoom;
+	l->color = color;
+	l->maxColor = 0;
+	l->minY = 0x7FFF;
+	l->maxY = -0x8000;
+	l->numShapes = 0;
+	l->numPoints = 0;
+	l->lastUse = ++_useCounter;
+	uint16 h = getHash(dataBuf, offset, zoom, color);
+	l->hashNext = _buckets[h];
+	_buckets[h] = num;
+	return l;
+}
+
+void ShapeCache::addShape(List *l, uint8 color, const Point &pt, const Polygon *pg) {
+	if (l->numShapes == l->maxShapes) {
+		l->maxShapes += 16;
+		l->shapes = (Shape *)realloc(l->shapes, l->maxShapes * sizeof(Shape));
+		if (!l->shapes) {
+			error("ShapeCache::addShape() unable to allocate %d shapes", l->maxShapes);
+		}
+	}
+	if (l->numPoints + pg->numPoints > l->maxPoints) {
+		l->maxPoints += MAX(pg->numPoints, 64);
+		l->points = (Point *)realloc((void *)l->points, l->maxPoints * sizeof(Point));
+		if (!l->points) {
+			error("ShapeCache::addShape() unable to allocate %d points", l->maxPoints);
+		}
+	}
+	Shape *s = &l->shapes[l->numShapes++];
+	s->x = pt.x;
+	s->y = pt.y;
+	s->color = color;
+	l->maxColor = MAX(l->maxColor, color);
+	s->numPoints = pg->numPoints;
+	s->bbw = pg->bbw;
+	s->bbh = pg->bbh;
+	s->firstPoint = l->numPoints;
+	int16 minY = 0, maxY = 0;
+	for (int i = 0; i < pg->numPoints; ++i) {
+		l->points[l->numPoints++] = pg->points[i];
+		minY = MIN(minY, pg->points[i].y);
+		maxY = MAX(maxY, pg->points[i].y);
+	}
+	// the polygon rows start at the top of the bounding box
+	const int16 y = pt.y - pg->bbh / 2;
+	l->minY = MIN(l->minY, y);
+	l->maxY = MAX(l->maxY, (int16)(y + maxY - minY));
+}
+
+uint16 ShapeCache::getHash(const uint8 *dataBuf, uint16 offset, uint16 zoom, uint8 color) {
+	uint32 h = (uint32)(size_t)dataBuf ^ offset ^ (zoom << 7) ^ (color << 13);
+	h ^= h >> 9;
+	return h & (HASH_SIZE - 1);
+}
+
+void ShapeCache::unlink(uint16 num) {
+	const List *l = &_lists[num];
+	uint16 *p = &_buckets[getHash(l->dataBuf, l->offset, l->zoom, l->color)];
+	while (*p != num) {
+		p = &_lists[*p].hashNext;
+	}
+	*p = l->hashNext;
+}
@@ -0,0 +1,75 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __SHAPECACHE_H__
+#define __SHAPECACHE_H__
+
+#include "intern.h"
+
+struct Polygon;
+
+// shape hierarchies flattened to lists of scaled polygons, keyed by
+// data buffer, offset, zoom and color, least recently used lists are dropped
+struct ShapeCache {
+	enum {
+		MAX_LISTS = 256,
+		HASH_SIZE = 512,
+		NO_LIST = 0xFFFF
+	};
+
+	struct Shape {
+		int16 x, y; // relative to the position the list is drawn at
+		uint8 color;
+		uint8 numPoints;
+		uint16 bbw, bbh;
+		uint32 firstPoint;
+	};
+
+	struct List {
+		const uint8 *dataBuf;
+		uint16 offset;
+		uint16 zoom;
+		uint8 color;
+		uint8 maxColor; // highest color of the shapes
+		int16 minY, maxY; // rows the shapes may cover, relative to the position
+		uint16 numShapes, maxShapes;
+		uint32 numPoints, maxPoints;
+		Shape *shapes;
+		Point *points;
+		uint32 lastUse;
+		uint16 hashNext;
+	};
+
+	List _lists[MAX_LISTS];
+	uint16 _numLists;
+	uint16 _buckets[HASH_SIZE];
+	uint32 _useCounter;
+
+	ShapeCache();
+	~ShapeCache();
+
+	void invalidate();
+	const List *find(const uint8 *dataBuf, uint16 offset, uint16 zoom, uint8 color);
+	List *add(const uint8 *dataBuf, uint16 offset, uint16 zoom, uint8 color);
+	void addShape(List *l, uint8 color, const Point &pt, const Polygon *pg);
+
+	static uint16 getHash(const uint8 *dataBuf, uint16 offset, uint16 zoom, uint8 color);
+	void unlink(uint16 num);
+};
+
+#endif
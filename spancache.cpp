@@ -0,0 +1,153 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "spancache.h"
+
+
+SpanCache::SpanCache()
+	: _maxSize(0), _size(0), _numLists(0), _useCounter(0), _rec(0), _numRec(0), _maxRec(0),
+	_recOverflow(false), _hits(0), _misses(0) {
+	memset(_lists, 0, sizeof(_lists));
+	memset(_buckets, 0xFF, sizeof(_buckets));
+	memset(_seen, 0, sizeof(_seen));
+}
+
+SpanCache::~SpanCache() {
+	dumpStats();
+	invalidate();
+	free(_rec);
+}
+
+void SpanCache::init(uint32 maxSize) {
+	_maxSize = maxSize;
+	if (_maxSize != 0) {
+		_maxRec = MAX_LIST_SPANS;
+		_rec = (Span *)malloc(_maxRec * sizeof(Span));
+		if (!_rec) {
+			error("SpanCache::init() unable to allocate %d spans", _maxRec);
+		}
+	}
+}
+
+void SpanCache::invalidate() {
+	dumpStats();
+	for (int i = 0; i < _numLists; ++i) {
+		free(_lists[i].spans);
+		_lists[i].spans = 0;
+	}
+	_numLists = 0;
+	_size = 0;
+	memset(_buckets, 0xFF, sizeof(_buckets));
+	memset(_seen, 0, sizeof(_seen));
+}
+
+void SpanCache::dumpStats() {
+	if (_hits + _misses != 0) {
+		debug(DBG_INFO, "SpanCache hits=%lu misses=%lu lists=%d size=%lu", _hits, _misses, _numLists, _size);
+		_hits = _misses = 0;
+	}
+}
+
+const SpanCache::List *SpanCache::find(const Key &k) {
+	uint16 num = _buckets[getHash(k) & (HASH_SIZE - 1)];
+	while (num != NO_LIST) {
+		List *l = &_lists[num];
+		if (l->key == k) {
+			l->lastUse = ++_useCounter;
+			++_hits;
+			return l;
+		}
+		num = l->hashNext;
+	}
+	++_misses;
+	return 0;
+}
+
+// the shapes drawn only once are not worth keeping
+bool SpanCache::startRecording(const Key &k) {
+	const uint32 h = getHash(k) | 1;
+	uint32 *seen = &_seen[(h >> 1) & (SEEN_SIZE - 1)];
+	if (*seen != h) {
+		*seen = h;
+		return false;
+	}
+	_numRec = 0;
+	_recOverflow = false;
+	return true;
+}
+
+void SpanCache::stopRecording(const Key &k) {
+	const uint32 size = _numRec * sizeof(Span);
+	if (_recOverflow || _numRec == 0 || size > _maxSize) {
+		return;
+	}
+	while (_numLists != 0 && (_numLists == MAX_LISTS || _size + size > _maxSize)) {
+		uint16 num = 0;
+		for (int i = 1; i < _numLists; ++i) {
+			if (_lists[i].lastUse < _lists[num].lastUse) {
+				num = i;
+			}
+		}
+		evict(num);
+	}
+	List *l = &_lists[_numLists];
+	l->spans = (Span *)malloc(size);
+	if (!l->spans) {
+		warning("SpanCache::stopRecording() unable to allocate %lu bytes", size);
+		return;
+	}
+	memcpy(l->spans, _rec, size);
+	l->key = k;
+	l->numSpans = _numRec;
+	l->lastUse = ++_useCounter;
+	const uint16 h = getHash(k) & (HASH_SIZE - 1);
+	l->hashNext = _buckets[h];
+	_buckets[h] = _numLists;
+	++_numLists;
+	_size += size;
+}
+
+uint32 SpanCache::getHash(const Key &k) {
+	uint32 h = (uint32)(size_t)k.dataBuf ^ k.offset ^ (k.zoom << 16) ^ k.color;
+	h = h * 31 + (uint16)k.x;
+	h = h * 31 + (uint16)k.y;
+	return h ^ (h >> 11);
+}
+
+// the last list is moved to the freed slot
+void SpanCache::evict(uint16 num) {
+	List *l = &_lists[num];
+	uint16 *p = &_buckets[getHash(l->key) & (HASH_SIZE - 1)];
+	while (*p != num) {
+		p = &_lists[*p].hashNext;
+	}
+	*p = l->hashNext;
+	_size -= l->numSpans * sizeof(Span);
+	free(l->spans);
+	l->spans = 0;
+	const uint16 last = --_numLists;
+	if (num != last) {
+		p = &_buckets[getHash(_lists[last].key) & (HASH_SIZE - 1)];
+		while (*p != last) {
+			p = &_lists[*p].hashNext;
+		}
+		*p = num;
+		*l = _lists[last];
+		_lists[last].spans = 0;
+	}
+}
@@ -0,0 +1,99 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __SPANCACHE_H__
+#define __SPANCACHE_H__
+
+#include "intern.h"
+
+// spans written by the drawing of a shape at a given position, replayed
+// instead of walking the polygon edges again
+struct SpanCache {
+	enum {
+		MAX_LISTS = 1024,
+		HASH_SIZE = 2048,
+		SEEN_SIZE = 1024,
+		MAX_LIST_SPANS = 8192,
+		NO_LIST = 0xFFFF,
+		POINT = 0xFFFF // x2 of the spans drawn with Video::drawPoint()
+	};
+
+	struct Key {
+		const uint8 *dataBuf;
+		uint16 offset;
+		uint16 zoom;
+		int16 x, y;
+		uint8 color;
+
+		bool operator==(const Key &k) const {
+			return dataBuf == k.dataBuf && offset == k.offset && zoom == k.zoom && x == k.x && y == k.y && color == k.color;
+		}
+	};
+
+	struct Span {
+		uint16 x1, x2;
+		uint16 y; // page row, above 255 with --hires
+		uint8 color;
+	};
+
+	struct List {
+		Key key;
+		uint16 numSpans;
+		Span *spans;
+		uint32 lastUse;
+		uint16 hashNext;
+	};
+
+	uint32 _maxSize; // bytes, 0 disables the cache
+	uint32 _size;
+	List _lists[MAX_LISTS];
+	uint16 _numLists;
+	uint16 _buckets[HASH_SIZE];
+	uint32 _seen[SEEN_SIZE]; // keys missed once, a list is recorded on the second miss
+	uint32 _useCounter;
+	Span *_rec;
+	uint16 _numRec, _maxRec;
+	bool _recOverflow;
+	uint32 _hits, _misses;
+
+	SpanCache();
+	~SpanCache();
+
+	void init(uint32 maxSize);
+	void invalidate();
+	void dumpStats();
+	const List *find(const Key &k);
+	bool startRecording(const Key &k);
+	void record(int16 x1, int16 x2, int16 y, uint8 color) {
+		if (_numRec == _maxRec) {
+			_recOverflow = true;
+			return;
+		}
+		Span *s = &_rec[_numRec++];
+		s->x1 = x1;
+		s->x2 = x2;
+		s->y = y;
+		s->color = color;
+	}
+	void stopRecording(const Key &k);
+
+	static uint32 getHash(const Key &k);
+	void evict(uint16 num);
+};
+
+#endif
@@ -0,0 +1,175 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "spanfill.h"
+#ifdef SPAN_SIMD_ENABLED
+#include <immintrin.h>
+#endif
+
+// the 8 bits of a plane byte spread to the 8 bytes, leftmost pixel first
+#define PLANAR_BIT(i, bit, byte) ((uint64)(((i) >> (bit)) & 1) << ((byte) * 8))
+#if defined SYS_LITTLE_ENDIAN
+#define PLANAR_ENTRY(i) (PLANAR_BIT(i, 7, 0) | PLANAR_BIT(i, 6, 1) | PLANAR_BIT(i, 5, 2) | PLANAR_BIT(i, 4, 3) | \
+	PLANAR_BIT(i, 3, 4) | PLANAR_BIT(i, 2, 5) | PLANAR_BIT(i, 1, 6) | PLANAR_BIT(i, 0, 7))
+#else
+#define PLANAR_ENTRY(i) (PLANAR_BIT(i, 7, 7) | PLANAR_BIT(i, 6, 6) | PLANAR_BIT(i, 5, 5) | PLANAR_BIT(i, 4, 4) | \
+	PLANAR_BIT(i, 3, 3) | PLANAR_BIT(i, 2, 2) | PLANAR_BIT(i, 1, 1) | PLANAR_BIT(i, 0, 0))
+#endif
+#define PLANAR_ENTRIES4(i) PLANAR_ENTRY(i), PLANAR_ENTRY(i + 1), PLANAR_ENTRY(i + 2), PLANAR_ENTRY(i + 3)
+#define PLANAR_ENTRIES16(i) PLANAR_ENTRIES4(i), PLANAR_ENTRIES4(i + 4), PLANAR_ENTRIES4(i + 8), PLANAR_ENTRIES4(i + 12)
+#define PLANAR_ENTRIES64(i) PLANAR_ENTRIES16(i), PLANAR_ENTRIES16(i + 16), PLANAR_ENTRIES16(i + 32), PLANAR_ENTRIES16(i + 48)
+
+static const uint64 _planarTable[256] = {
+	PLANAR_ENTRIES64(0), PLANAR_ENTRIES64(64), PLANAR_ENTRIES64(128), PLANAR_ENTRIES64(192)
+};
+
+#undef PLANAR_ENTRIES64
+#undef PLANAR_ENTRIES16
+#undef PLANAR_ENTRIES4
+#undef PLANAR_ENTRY
+#undef PLANAR_BIT
+
+static void fillScalar(uint8 *dst, uint8 color, uint16 w) {
+	while (w--) {
+		*dst++ = color;
+	}
+}
+
+static void copyScalar(uint8 *dst, const uint8 *src, uint16 w) {
+	while (w--) {
+		*dst++ = *src++;
+	}
+}
+
+static void maskScalar(uint8 *dst, uint8 bits, uint16 w) {
+	while (w--) {
+		*dst++ |= bits;
+	}
+}
+
+// 4 table lookups per 8 pixels, faster than spreading the bits with SSE2
+// or AVX2 shuffles and compares
+static void planarScalar(uint8 *dst, const uint8 *src, uint32 planeSize, uint16 w) {
+	for (; w >= 8; w -= 8, dst += 8, ++src) {
+		const uint64 c = _planarTable[src[0]] | (_planarTable[src[planeSize]] << 1) |
+			(_planarTable[src[planeSize * 2]] << 2) | (_planarTable[src[planeSize * 3]] << 3);
+		memcpy(dst, &c, 8);
+	}
+}
+
+// the bit by bit conversion copyPagePtr() used before the kernels, planar_bench
+// checks them against it
+void planarReference(uint8 *dst, const uint8 *src, uint32 planeSize, uint16 w) {
+	for (; w >= 8; w -= 8, ++src) {
+		uint8 p[] = {
+			*(src + planeSize * 3),
+			*(src + planeSize * 2),
+			*(src + planeSize * 1),
+			*(src + planeSize * 0)
+		};
+		for (int i = 0; i < 8; ++i) {
+			uint8 c = 0;
+			for (int j = 0; j < 4; ++j) {
+				c = (c << 1) | (p[j] >> 7);
+				p[j] <<= 1;
+			}
+			*dst++ = c;
+		}
+	}
+}
+
+const SpanKernels g_spanKernelsScalar = {
+	"scalar", fillScalar, copyScalar, maskScalar, planarScalar
+};
+
+#ifdef SPAN_SIMD_ENABLED
+
+__attribute__((target("sse2")))
+static void fillSSE2(uint8 *dst, uint8 color, uint16 w) {
+	const __m128i c = _mm_set1_epi8(color);
+	for (; w >= 16; w -= 16, dst += 16) {
+		_mm_storeu_si128((__m128i *)dst, c);
+	}
+	fillScalar(dst, color, w);
+}
+
+__attribute__((target("sse2")))
+static void copySSE2(uint8 *dst, const uint8 *src, uint16 w) {
+	for (; w >= 16; w -= 16, dst += 16, src += 16) {
+		_mm_storeu_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+	}
+	copyScalar(dst, src, w);
+}
+
+__attribute__((target("sse2")))
+static void maskSSE2(uint8 *dst, uint8 bits, uint16 w) {
+	const __m128i b = _mm_set1_epi8(bits);
+	for (; w >= 16; w -= 16, dst += 16) {
+		_mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_loadu_si128((const __m128i *)dst), b));
+	}
+	maskScalar(dst, bits, w);
+}
+
+const SpanKernels g_spanKernelsSSE2 = {
+	"sse2", fillSSE2, copySSE2, maskSSE2, planarScalar
+};
+
+__attribute__((target("avx2")))
+static void fillAVX2(uint8 *dst, uint8 color, uint16 w) {
+	const __m256i c = _mm256_set1_epi8(color);
+	for (; w >= 32; w -= 32, dst += 32) {
+		_mm256_storeu_si256((__m256i *)dst, c);
+	}
+	fillSSE2(dst, color, w);
+}
+
+__attribute__((target("avx2")))
+static void copyAVX2(uint8 *dst, const uint8 *src, uint16 w) {
+	for (; w >= 32; w -= 32, dst += 32, src += 32) {
+		_mm256_storeu_si256((__m256i *)dst, _mm256_loadu_si256((const __m256i *)src));
+	}
+	copySSE2(dst, src, w);
+}
+
+__attribute__((target("avx2")))
+static void maskAVX2(uint8 *dst, uint8 bits, uint16 w) {
+	const __m256i b = _mm256_set1_epi8(bits);
+	for (; w >= 32; w -= 32, dst += 32) {
+		_mm256_storeu_si256((__m256i *)dst, _mm256_or_si256(_mm256_loadu_si256((const __m256i *)dst), b));
+	}
+	maskSSE2(dst, bits, w);
+}
+
+const SpanKernels g_spanKernelsAVX2 = {
+	"avx2", fillAVX2, copyAVX2, maskAVX2, planarScalar
+};
+
+#endif
+
+const SpanKernels *getSpanKernels() {
+#ifdef SPAN_SIMD_ENABLED
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return &g_spanKernelsAVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return &g_spanKernelsSSE2;
+	}
+#endif
+	return &g_spanKernelsScalar;
+}
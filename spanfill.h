@@ -0,0 +1,47 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __SPANFILL_H__
+#define __SPANFILL_H__
+
+#include "intern.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPAN_SIMD_ENABLED
+#endif
+
+// writers for the pixels of a polygon span, one byte per pixel
+struct SpanKernels {
+	const char *name;
+	void (*fill)(uint8 *dst, uint8 color, uint16 w);
+	void (*copy)(uint8 *dst, const uint8 *src, uint16 w);
+	void (*mask)(uint8 *dst, uint8 bits, uint16 w); // *dst |= bits
+	// the 4 bitplanes of a background row, planeSize bytes apart, w is a multiple of 8
+	void (*planar)(uint8 *dst, const uint8 *src, uint32 planeSize, uint16 w);
+};
+
+extern const SpanKernels g_spanKernelsScalar;
+#ifdef SPAN_SIMD_ENABLED
+extern const SpanKernels g_spanKernelsSSE2;
+extern const SpanKernels g_spanKernelsAVX2;
+#endif
+
+extern const SpanKernels *getSpanKernels();
+extern void planarReference(uint8 *dst, const uint8 *src, uint32 planeSize, uint16 w);
+
+#endif
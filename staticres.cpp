@@ -16,7 +16,9 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
+#include "decoder.h"
 #include "logic.h"
+#include "peephole.h"
 #include "resource.h"
 #include "video.h"
 
@@ -58,6 +60,43 @@ const Logic::OpcodeStub Logic::_opTable[] = {
 	&Logic::op_playMusic
 };
 
+const Logic::OpcodeStub Logic::_verifiedOpTable[] = {
+	/* 0x00 */
+	&Logic::op_movConst,
+	&Logic::op_mov,
+	&Logic::op_add,
+	&Logic::op_addConst,
+	/* 0x04 */
+	&Logic::op_callUnchecked,
+	&Logic::op_retUnchecked,
+	&Logic::op_break,
+	&Logic::op_jmp,
+	/* 0x08 */
+	&Logic::op_setScriptSlot,
+	&Logic::op_jnz,
+	&Logic::op_condJmp,
+	&Logic::op_setPalette,
+	/* 0x0C */
+	&Logic::op_resetScript,
+	&Logic::op_selectPage,
+	&Logic::op_fillPage,
+	&Logic::op_copyPage,
+	/* 0x10 */
+	&Logic::op_updateDisplay,
+	&Logic::op_halt,
+	&Logic::op_drawString,
+	&Logic::op_sub,
+	/* 0x14 */
+	&Logic::op_and,
+	&Logic::op_or,
+	&Logic::op_shl,
+	&Logic::op_shr,
+	/* 0x18 */
+	&Logic::op_playSound,
+	&Logic::op_updateMemList,
+	&Logic::op_playMusic
+};
+
 const uint16 Logic::_freqTable[] = {
 	0x0CFF, 0x0DC3, 0x0E91, 0x0F6F, 0x1056, 0x114E, 0x1259, 0x136C, 
 	0x149F, 0x15D9, 0x1726, 0x1888, 0x19FD, 0x1B86, 0x1D21, 0x1EDE, 
@@ -66,6 +105,18 @@ const uint16 Logic::_freqTable[] = {
 	0x5240, 0x5764, 0x5C9A, 0x61C8, 0x6793, 0x6E19, 0x7485, 0x7BBD
 };
 
+const Decoder::InterpretedOp Decoder::_interpretedOps[] = {
+	{ 0x3E86, 0x6D47 }, // Logic::op_addConst() gun sound hack
+#ifdef BYPASS_PROTECTION
+	{ 0x3E80, 0x0CB8 }, // Logic::op_condJmp() patches the script bytes
+#endif
+	{ 0, 0 }
+};
+
+const char *Peephole::_kindNames[] = {
+	"movConst", "addConst", "condJmp", "loop", "loopAdd", "loopMov"
+};
+
 const uint16 Resource::_memListParts[][4] = {
 	{ 0x14, 0x15, 0x16, 0x00 }, // protection screens
 	{ 0x17, 0x18, 0x19, 0x00 }, // introduction
@@ -25,6 +25,8 @@ typedef unsigned short uint16;
 typedef signed short int16;
 typedef unsigned long uint32;
 typedef signed long int32;
+typedef unsigned long long uint64;
+typedef signed long long int64;
 
 #if defined SYS_LITTLE_ENDIAN
 
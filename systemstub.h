@@ -43,16 +43,19 @@ struct PlayerInput {
 struct SystemStub {
 	typedef void (*AudioCallback)(void *param, uint8 *stream, int len);
 	typedef uint32 (*TimerCallback)(uint32 delay, void *param);
+	typedef int (*ThreadProc)(void *param);
 	
 	PlayerInput _pi;
 
 	virtual ~SystemStub() {}
 
-	virtual void init(const char *title) = 0;
+	virtual void init(const char *title, uint16 w, uint16 h) = 0;
 	virtual void destroy() = 0;
 
 	virtual void setPalette(uint8 s, uint8 n, const uint8 *buf) = 0;
+	// buf holds one byte per pixel
 	virtual void copyRect(uint16 x, uint16 y, uint16 w, uint16 h, const uint8 *buf, uint32 pitch) = 0;
+	virtual void copyRects(const Rect *rects, uint16 count, const uint8 *buf, uint32 pitch) = 0;
 
 	virtual void processEvents() = 0;
 	virtual void sleep(uint32 duration) = 0;
@@ -69,6 +72,14 @@ struct SystemStub {
 	virtual void destroyMutex(void *mutex) = 0;
 	virtual void lockMutex(void *mutex) = 0;
 	virtual void unlockMutex(void *mutex) = 0;
+
+	virtual void *createThread(ThreadProc proc, void *param) = 0;
+	virtual void waitThread(void *thread) = 0;
+
+	virtual void *createSemaphore(uint32 value) = 0;
+	virtual void destroySemaphore(void *sem) = 0;
+	virtual void waitSemaphore(void *sem) = 0;
+	virtual void postSemaphore(void *sem) = 0;
 };
 
 struct MutexStack {
@@ -0,0 +1,180 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <ctime>
+#include "trace.h"
+#include "intern.h"
+#include "systemstub.h"
+
+
+Trace::Ring *Trace::_rings[MAX_RINGS];
+uint32 Trace::_numRings;
+SystemStub *Trace::_stub;
+void *Trace::_thread;
+bool Trace::_quit;
+
+static __thread Trace::Ring *t_ring;
+static __thread bool t_noRing; // the rings were all taken, the thread records nothing
+
+void Trace::start(SystemStub *stub) {
+	_stub = stub;
+	_quit = false;
+	_thread = _stub->createThread(threadProc, 0);
+}
+
+void Trace::stop() {
+	if (_thread) {
+		__atomic_store_n(&_quit, true, __ATOMIC_RELEASE);
+		_stub->waitThread(_thread);
+		_thread = 0;
+	}
+	drain();
+}
+
+void Trace::push(uint16 cm, const char *fmt, const uint64 *args, uint8 numArgs) {
+	Ring *ring = getRing();
+	if (!ring) {
+		return;
+	}
+	uint32 head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	Record *r = &ring->records[head & (RING_SIZE - 1)];
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	r->time = (uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	r->fmt = fmt;
+	r->cm = cm;
+	r->numArgs = MIN(numArgs, (uint8)MAX_ARGS);
+	memcpy(r->args, args, r->numArgs * sizeof(uint64));
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+Trace::Ring *Trace::getRing() {
+	if (!t_ring && !t_noRing) {
+		// _numRings stops at MAX_RINGS, the slots are never reused
+		uint32 num = __atomic_load_n(&_numRings, __ATOMIC_ACQUIRE);
+		do {
+			if (num >= MAX_RINGS) {
+				t_noRing = true;
+				warning("Trace::getRing() no ring left, the thread is not traced");
+				return 0;
+			}
+		} while (!__atomic_compare_exchange_n(&_numRings, &num, num + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+		t_ring = (Ring *)calloc(1, sizeof(Ring));
+		if (!t_ring) {
+			error("Trace::getRing() unable to allocate ring buffer");
+		}
+		__atomic_store_n(&_rings[num], t_ring, __ATOMIC_RELEASE);
+	}
+	return t_ring;
+}
+
+uint32 Trace::drain() {
+	uint32 count = 0;
+	uint32 numRings = MIN(__atomic_load_n(&_numRings, __ATOMIC_ACQUIRE), (uint32)MAX_RINGS);
+	for (uint32 i = 0; i < numRings; ++i) {
+		Ring *ring = __atomic_load_n(&_rings[i], __ATOMIC_ACQUIRE);
+		if (!ring) {
+			continue;
+		}
+		uint32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint32 tail = ring->tail;
+		for (; tail != head; ++tail, ++count) {
+			const Record *r = &ring->records[tail & (RING_SIZE - 1)];
+			char buf[1024];
+			format(r, buf, sizeof(buf));
+			printf("[%llu.%06llu] %s\n", r->time / 1000000000ULL, (r->time / 1000) % 1000000ULL, buf);
+		}
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		uint32 dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_ACQ_REL);
+		if (dropped != 0) {
+			printf("Trace ring %lu dropped %lu records\n", i, dropped);
+		}
+	}
+	if (count != 0) {
+		fflush(stdout);
+	}
+	return count;
+}
+
+// expands the printf conversions of the format one argument at a time
+void Trace::format(const Record *r, char *buf, uint32 bufSize) {
+	const char *p = r->fmt;
+	uint32 len = 0;
+	uint8 arg = 0;
+	while (*p && len < bufSize - 1) {
+		if (*p != '%') {
+			buf[len++] = *p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			buf[len++] = '%';
+			p += 2;
+			continue;
+		}
+		char spec[16];
+		uint8 specLen = 0;
+		bool longArg = false;
+		spec[specLen++] = *p++;
+		while (*p && !strchr("diouxXcsp", *p)) {
+			if (*p == 'l') {
+				longArg = true;
+			} else if (*p != 'h' && specLen < sizeof(spec) - 3) {
+				spec[specLen++] = *p;
+			}
+			++p;
+		}
+		if (!*p) {
+			break;
+		}
+		if (longArg) {
+			spec[specLen++] = 'l';
+		}
+		spec[specLen++] = *p;
+		spec[specLen] = 0;
+		uint64 a = (arg < r->numArgs) ? r->args[arg] : 0;
+		++arg;
+		int n;
+		if (*p == 's') {
+			n = snprintf(buf + len, bufSize - len, spec, (const char *)(size_t)a);
+		} else if (*p == 'p') {
+			n = snprintf(buf + len, bufSize - len, spec, (void *)(size_t)a);
+		} else if (longArg) {
+			n = snprintf(buf + len, bufSize - len, spec, (long)a);
+		} else {
+			n = snprintf(buf + len, bufSize - len, spec, (int)a);
+		}
+		if (n > 0) {
+			len = MIN(len + n, bufSize - 1);
+		}
+		++p;
+	}
+	buf[len] = 0;
+}
+
+int Trace::threadProc(void *param) {
+	while (!__atomic_load_n(&_quit, __ATOMIC_ACQUIRE)) {
+		if (drain() == 0) {
+			_stub->sleep(10);
+		}
+	}
+	return 0;
+}
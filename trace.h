@@ -0,0 +1,74 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "sys.h"
+
+struct SystemStub;
+
+// binary debug() records, appended to a ring buffer owned by the calling
+// thread and formatted later by the drain thread started with Trace::start()
+struct Trace {
+	enum {
+		MAX_ARGS = 6,
+		MAX_RINGS = 32,
+		RING_SIZE = 4096 // records, power of two
+	};
+
+	struct Record {
+		uint64 time;     // nanoseconds
+		const char *fmt; // format id, the string literal of the debug() call
+		uint16 cm;
+		uint8 numArgs;
+		uint64 args[MAX_ARGS];
+	};
+
+	// single producer, single consumer
+	struct Ring {
+		Record records[RING_SIZE];
+		uint32 head; // written by the owning thread
+		uint32 tail; // written by the drain thread
+		uint32 dropped;
+	};
+
+	static Ring *_rings[MAX_RINGS];
+	static uint32 _numRings;
+	static SystemStub *_stub;
+	static void *_thread;
+	static bool _quit;
+
+	static void start(SystemStub *stub);
+	static void stop();
+
+	// %s arguments are stored as pointers and must outlive the drain thread
+	template<typename... Args>
+	static void record(uint16 cm, const char *fmt, Args... args) {
+		const uint64 a[] = { 0, (uint64)args... };
+		push(cm, fmt, a + 1, sizeof...(args));
+	}
+	static void push(uint16 cm, const char *fmt, const uint64 *args, uint8 numArgs);
+
+	static Ring *getRing();
+	static uint32 drain();
+	static void format(const Record *r, char *buf, uint32 bufSize);
+	static int threadProc(void *param);
+};
+
+#endif
@@ -22,16 +22,14 @@
 
 uint16 g_debugMask;
 
-void debug(uint16 cm, const char *msg, ...) {
+void debugPrint(uint16 cm, const char *msg, ...) {
 	char buf[1024];
-	if (cm & g_debugMask) {
-		va_list va;
-		va_start(va, msg);
-		vsprintf(buf, msg, va);
-		va_end(va);
-		printf("%s\n", buf);
-		fflush(stdout);
-	}
+	va_list va;
+	va_start(va, msg);
+	vsprintf(buf, msg, va);
+	va_end(va);
+	printf("%s\n", buf);
+	fflush(stdout);
 }
 
 void error(const char *msg, ...) {
@@ -68,3 +66,13 @@ void string_upper(char *p) {
 		}
 	}
 }
+
+uint32 hash32(const uint8 *p, uint32 len) {
+	// FNV-1a
+	uint32 h = 0x811C9DC5;
+	while (len--) {
+		h ^= *p++;
+		h = (h * 0x01000193) & 0xFFFFFFFF;
+	}
+	return h;
+}
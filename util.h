@@ -30,13 +30,46 @@ enum {
 	DBG_INFO  = 1 << 5
 };
 
+// categories compiled in, the debug() calls of the others compile to nothing
+#ifndef DBG_BUILD_MASK
+#define DBG_BUILD_MASK DBG_INFO
+#endif
+
+// categories recorded by Trace instead of being printed when USE_TRACE is defined
+#ifndef DBG_TRACE_MASK
+#define DBG_TRACE_MASK (DBG_LOGIC | DBG_VIDEO | DBG_SND)
+#endif
+
 extern uint16 g_debugMask;
 
-extern void debug(uint16 cm, const char *msg, ...);
+extern void debugPrint(uint16 cm, const char *msg, ...);
+
+#ifdef USE_TRACE
+#include "trace.h"
+#define debug(cm, ...) \
+	do { \
+		if (((cm) & DBG_BUILD_MASK) && ((cm) & g_debugMask)) { \
+			if ((cm) & DBG_TRACE_MASK) { \
+				Trace::record(cm, __VA_ARGS__); \
+			} else { \
+				debugPrint(cm, __VA_ARGS__); \
+			} \
+		} \
+	} while (0)
+#else
+#define debug(cm, ...) \
+	do { \
+		if (((cm) & DBG_BUILD_MASK) && ((cm) & g_debugMask)) { \
+			debugPrint(cm, __VA_ARGS__); \
+		} \
+	} while (0)
+#endif
 extern void error(const char *msg, ...);
 extern void warning(const char *msg, ...);
 
 extern void string_lower(char *p);
 extern void string_upper(char *p);
 
+extern uint32 hash32(const uint8 *p, uint32 len);
+
 #endif
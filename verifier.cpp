@@ -0,0 +1,257 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "verifier.h"
+#include "decoder.h"
+
+
+static const uint32 TOP_LEVEL = 1;
+
+Verifier::Verifier()
+	: _seg(0), _segSize(0), _video1Size(0), _video2Size(0), _numEntries(0), _workSize(0), _numFuncs(0), _calls(0), _numCalls(0), _maxCalls(0) {
+	_entries = (uint8 *)malloc(0x10000 / 8);
+	_entryList = (uint16 *)malloc(0x10000 * sizeof(uint16));
+	_visited = (uint32 *)malloc(0x10000 * sizeof(uint32));
+	_workList = (uint16 *)malloc(0x10000 * sizeof(uint16));
+	_funcs = (uint16 *)malloc(0x10000 * sizeof(uint16));
+	_funcMap = (uint16 *)malloc(0x10000 * sizeof(uint16));
+	_funcState = (uint8 *)malloc(0x10000);
+	_funcDepth = (uint8 *)malloc(0x10000);
+	_firstCall = (uint32 *)malloc((0x10000 + 1) * sizeof(uint32));
+	if (!_entries || !_entryList || !_visited || !_workList || !_funcs || !_funcMap || !_funcState || !_funcDepth || !_firstCall) {
+		error("Verifier::Verifier() unable to allocate tables");
+	}
+	memset(_entries, 0, 0x10000 / 8);
+}
+
+Verifier::~Verifier() {
+	free(_calls);
+	free(_firstCall);
+	free(_funcDepth);
+	free(_funcState);
+	free(_funcMap);
+	free(_funcs);
+	free(_workList);
+	free(_visited);
+	free(_entryList);
+	free(_entries);
+}
+
+bool Verifier::verify(const uint8 *seg, uint16 segSize, uint16 video1Size, uint16 video2Size) {
+	_seg = seg;
+	_segSize = segSize;
+	_video1Size = video1Size;
+	_video2Size = video2Size;
+	memset(_entries, 0, 0x10000 / 8);
+	memset(_visited, 0, 0x10000 * sizeof(uint32));
+	memset(_funcMap, 0xFF, 0x10000 * sizeof(uint16));
+	_numEntries = 0;
+	_numFuncs = 0;
+	_numCalls = 0;
+	// slot 0 starts at the beginning of the segment, the other entries are
+	// found from the op_setScriptSlot and op_break instructions
+	addEntry(0);
+	uint32 entry = 0;
+	uint32 func = 0;
+	while (entry < _numEntries || func < _numFuncs) {
+		while (entry < _numEntries) {
+			if (!walk(TOP_LEVEL, _entryList[entry++])) {
+				return false;
+			}
+		}
+		while (func < _numFuncs) {
+			_firstCall[func] = _numCalls;
+			if (!walk(TOP_LEVEL + 1 + func, _funcs[func])) {
+				return false;
+			}
+			++func;
+		}
+	}
+	_firstCall[_numFuncs] = _numCalls;
+	for (uint32 i = 0; i < _numFuncs; ++i) {
+		if ((_funcState[i] & FS_ROOT) && callDepth(i, 1) < 0) {
+			debug(DBG_LOGIC, "Verifier::verify() unbounded call depth from 0x%X", _funcs[i]);
+			return false;
+		}
+	}
+	debug(DBG_LOGIC, "Verifier::verify() %lu entries %lu functions", _numEntries, _numFuncs);
+	return true;
+}
+
+void Verifier::addEntry(uint16 pos) {
+	if (!isEntry(pos)) {
+		_entries[pos >> 3] |= 1 << (pos & 7);
+		_entryList[_numEntries++] = pos;
+	}
+}
+
+uint16 Verifier::addFunc(uint16 pos) {
+	uint16 i = _funcMap[pos];
+	if (i == NO_FUNC) {
+		i = _numFuncs++;
+		_funcs[i] = pos;
+		_funcState[i] = 0;
+		_funcMap[pos] = i;
+	}
+	return i;
+}
+
+void Verifier::addCall(uint16 func) {
+	if (_numCalls == _maxCalls) {
+		_maxCalls = _maxCalls ? _maxCalls * 2 : 256;
+		_calls = (uint16 *)realloc(_calls, _maxCalls * sizeof(uint16));
+		if (!_calls) {
+			error("Verifier::addCall() unable to allocate %d calls", _maxCalls);
+		}
+	}
+	_calls[_numCalls++] = func;
+}
+
+bool Verifier::walk(uint32 context, uint16 pos) {
+	_workSize = 0;
+	_workList[_workSize++] = pos;
+	while (_workSize != 0) {
+		pos = _workList[--_workSize];
+		while (_visited[pos] != context) {
+			_visited[pos] = context;
+			uint16 len = Decoder::opLength(_seg, _segSize, pos);
+			if (len == 0) {
+				debug(DBG_LOGIC, "Verifier::walk() invalid instruction at 0x%X", pos);
+				return false;
+			}
+			if (!checkShape(pos)) {
+				debug(DBG_LOGIC, "Verifier::walk() shape offset out of bounds at 0x%X", pos);
+				return false;
+			}
+			const uint8 *p = _seg + pos;
+			uint16 target = 0;
+			switch (p[0]) {
+			case 0x04: // op_call
+			case 0x07: // op_jmp
+				target = READ_BE_UINT16(p + 1);
+				break;
+			case 0x08: // op_setScriptSlot
+				target = READ_BE_UINT16(p + 2);
+				if (target >= 0xFFFE) {
+					// stops the slot
+					target = 0;
+				}
+				break;
+			case 0x09: // op_jnz
+				target = READ_BE_UINT16(p + 2);
+				break;
+			case 0x0A: // op_condJmp
+				// an unknown comparison never branches
+				if ((p[1] & 7) <= 5) {
+					target = READ_BE_UINT16(p + len - 2);
+				}
+				break;
+			}
+			if (target >= _segSize) {
+				debug(DBG_LOGIC, "Verifier::walk() target 0x%X out of bounds at 0x%X", target, pos);
+				return false;
+			}
+			uint16 next = pos + len;
+			switch (p[0]) {
+			case 0x04: { // op_call
+					uint16 func = addFunc(target);
+					if (context == TOP_LEVEL) {
+						_funcState[func] |= FS_ROOT;
+					} else {
+						addCall(func);
+					}
+				}
+				break;
+			case 0x05: // op_ret
+				if (context == TOP_LEVEL) {
+					debug(DBG_LOGIC, "Verifier::walk() stack underflow at 0x%X", pos);
+					return false;
+				}
+				next = pos;
+				break;
+			case 0x06: // op_break
+				// the slot resumes from the next instruction with an empty stack
+				addEntry(next);
+				next = pos;
+				break;
+			case 0x07: // op_jmp
+				next = target;
+				break;
+			case 0x08: // op_setScriptSlot
+				addEntry(target);
+				break;
+			case 0x09: // op_jnz
+				_workList[_workSize++] = target;
+				break;
+			case 0x0A: // op_condJmp
+				if ((p[1] & 7) <= 5) {
+					_workList[_workSize++] = target;
+				}
+				break;
+			case 0x11: // op_halt
+				next = pos;
+				break;
+			}
+			pos = next;
+		}
+	}
+	return true;
+}
+
+bool Verifier::checkShape(uint16 pos) const {
+	const uint8 *p = _seg + pos;
+	uint8 opcode = p[0];
+	if (opcode & 0x80) {
+		uint16 off = ((opcode << 8) | p[1]) * 2;
+		return off < _video1Size;
+	} else if (opcode & 0x40) {
+		uint16 off = READ_BE_UINT16(p + 1) * 2;
+		bool useSegVideo2 = (opcode & 3) == 3;
+		return off < (useSegVideo2 ? _video2Size : _video1Size);
+	}
+	return true;
+}
+
+// returns the number of nested calls starting with a call to func, or -1
+// when func can recurse or overflow the stack
+int Verifier::callDepth(uint16 func, int level) {
+	if (_funcState[func] & FS_DONE) {
+		return _funcDepth[func];
+	}
+	if ((_funcState[func] & FS_ACTIVE) || level > MAX_CALL_DEPTH) {
+		return -1;
+	}
+	_funcState[func] |= FS_ACTIVE;
+	int depth = 0;
+	for (uint32 i = _firstCall[func]; i < _firstCall[func + 1]; ++i) {
+		int d = callDepth(_calls[i], level + 1);
+		if (d < 0) {
+			return -1;
+		}
+		if (d > depth) {
+			depth = d;
+		}
+	}
+	++depth;
+	if (depth > MAX_CALL_DEPTH) {
+		return -1;
+	}
+	_funcState[func] = (_funcState[func] & ~FS_ACTIVE) | FS_DONE;
+	_funcDepth[func] = depth;
+	return depth;
+}
@@ -0,0 +1,81 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __VERIFIER_H__
+#define __VERIFIER_H__
+
+#include "intern.h"
+
+// proves once per part that the reachable bytecode only holds valid opcodes,
+// that its branch, call and slot targets and its shape offsets stay inside
+// their segments and that the call stack can neither overflow nor underflow
+struct Verifier {
+	enum {
+		MAX_CALL_DEPTH = 0xFF,
+		NO_FUNC = 0xFFFF
+	};
+
+	enum {
+		// function states
+		FS_ROOT   = 1 << 0, // called from the top level of a slot
+		FS_ACTIVE = 1 << 1,
+		FS_DONE   = 1 << 2
+	};
+
+	// result of a verification, as stored in the CodeCache
+	struct Result {
+		uint16 video1Size, video2Size;
+		uint8 verified;
+		uint8 entries[0x10000 / 8];
+	};
+
+	const uint8 *_seg;
+	uint16 _segSize;
+	uint16 _video1Size, _video2Size;
+	uint8 *_entries;      // offsets a slot can start or resume from
+	uint16 *_entryList;
+	uint32 _numEntries;
+	uint32 *_visited;     // context of the last walk through each offset
+	uint16 *_workList;
+	uint32 _workSize;
+	uint16 *_funcs;       // call targets
+	uint16 *_funcMap;
+	uint32 _numFuncs;
+	uint8 *_funcState;
+	uint8 *_funcDepth;
+	uint32 *_firstCall;   // callees of each function, in _calls
+	uint16 *_calls;
+	uint32 _numCalls, _maxCalls;
+
+	Verifier();
+	~Verifier();
+
+	bool verify(const uint8 *seg, uint16 segSize, uint16 video1Size, uint16 video2Size);
+	bool isEntry(uint16 pos) const {
+		return (_entries[pos >> 3] & (1 << (pos & 7))) != 0;
+	}
+
+	void addEntry(uint16 pos);
+	uint16 addFunc(uint16 pos);
+	void addCall(uint16 func);
+	bool walk(uint32 context, uint16 pos);
+	bool checkShape(uint16 pos) const;
+	int callDepth(uint16 func, int level);
+};
+
+#endif
@@ -17,6 +17,7 @@
  */
 
 #include "video.h"
+#include "rendertrace.h"
 #include "resource.h"
 #include "serializer.h"
 #include "systemstub.h"
@@ -34,22 +35,110 @@ void Polygon::init(const uint8 *p, uint16 zoom) {
 	}
 }
 
+uint16 Raster::_interpTable[0x400];
+const StrEntry *Raster::_stringsIndex[MAX_STRING_IDS];
+uint64 Raster::_fontMasks[FONT_GLYPHS * 8];
+
 Video::Video(Resource *res, SystemStub *stub) 
-	: _res(res), _stub(stub) {
+	: _res(res), _stub(stub), _deferred(false), _rasterPool(stub), _numBands(0), _trace(0) {
+	memset(_pageBufs, 0, sizeof(_pageBufs));
 }
 
-void Video::init() {
+Video::~Video() {
+	freeWorkers();
+	stopTrace();
+	for (int i = 0; i < MAX_PAGE_BUFS; ++i) {
+		free(_pageBufs[i]);
+	}
+}
+
+void Video::init(uint16 w, uint16 h) {
 	_newPal = 0xFF;
+	_w = w;
+	_h = h;
+	_hires = (w != VID_PAGE_W || h != VID_PAGE_H);
+	_pitch = 64;
+	while (_pitch < _w) {
+		_pitch <<= 1;
+	}
+	_pageSize = _pitch * _h;
+	_dirtyShiftX = 4;
+	_dirtyShiftY = 3;
+	while ((DIRTY_COLS << _dirtyShiftX) < _w || (DIRTY_ROWS << _dirtyShiftY) < _h) {
+		++_dirtyShiftX;
+		++_dirtyShiftY;
+	}
+	_clipY1 = 0;
+	_clipY2 = _h;
+	debug(DBG_INFO, "Video::init() %dx%d pages", _w, _h);
+	memset(_dirtyMasks, 0, sizeof(_dirtyMasks));
+	memset(_pageBufRefs, 0, sizeof(_pageBufRefs));
 	for (int i = 0; i < 4; ++i) {
-		_pagePtrs[i] = allocPage();
+		const uint8 buf = allocPageBuf();
+		++_pageBufRefs[buf];
+		_pageBufNums[i] = buf;
+		_pagePtrs[i] = _pageBufs[buf];
+		_pageScrolls[i].buf = NO_PAGE_BUF;
+		markAllDirty(_dirtyMasks[i]);
+		_drawLists[i].numCmds = 0;
+		_drawLists[i].readsPage0 = false;
 	}
-	_curPagePtr3 = getPagePtr(1);
-	_curPagePtr2 = getPagePtr(2);
+	_curPage3 = 1;
+	_curPage2 = 2;
 	changePagePtr1(0xFE);
+	_spans = getSpanKernels();
+	debug(DBG_INFO, "Video::init() using %s span kernels", _spans->name);
 	_interpTable[0] = 0x4000;
 	for (int i = 1; i < 0x400; ++i) {
 		_interpTable[i] = 0x4000 / i;
 	}
+	indexStrings(_stringsTableEng);
+	for (int i = 0; i < FONT_GLYPHS * 8; ++i) {
+		uint8 mask[8];
+		for (int j = 0; j < 8; ++j) {
+			mask[j] = (_font[i] & (0x80 >> j)) ? 0xFF : 0;
+		}
+		memcpy(&_fontMasks[i], mask, 8);
+	}
+}
+
+// the first entry of an id is kept, as when walking the table
+void Video::indexStrings(const StrEntry *table) {
+	memset(_stringsIndex, 0, sizeof(_stringsIndex));
+	for (const StrEntry *se = table; se->id != 0xFFFF; ++se) {
+		if (se->id >= MAX_STRING_IDS) {
+			warning("Video::indexStrings() id 0x%X out of range", se->id);
+		} else if (!_stringsIndex[se->id]) {
+			_stringsIndex[se->id] = se;
+		}
+	}
+}
+
+void Video::initWorkers(int numThreads) {
+	if (numThreads > 1) {
+		_rasterPool.init(numThreads - 1);
+		_numBands = (_h + (1 << _dirtyShiftY) - 1) >> _dirtyShiftY;
+	}
+}
+
+void Video::freeWorkers() {
+	if (_numBands != 0) {
+		_rasterPool.free();
+		_numBands = 0;
+	}
+}
+
+void Video::startTrace(const char *filename, const char *directory) {
+	_trace = new RenderTrace;
+	if (!_trace->open(filename, directory, _w, _h)) {
+		delete _trace;
+		_trace = 0;
+	}
+}
+
+void Video::stopTrace() {
+	delete _trace;
+	_trace = 0;
 }
 
 void Video::setDataBuffer(uint8 *dataBuf, uint16 offset) {
@@ -58,37 +147,198 @@ void Video::setDataBuffer(uint8 *dataBuf, uint16 offset) {
 }
 
 void Video::drawShape(uint8 color, uint16 zoom, const Point &pt) {
+	if (_trace) {
+		_trace->writeShape(_dataBuf != _res->_segVideo1, _pData.pc - _dataBuf, color, zoom, pt);
+	}
+	if (_deferred) {
+		// resolving the other lists moves _pData
+		uint8 *dataBuf = _dataBuf;
+		const uint16 offset = _pData.pc - _dataBuf;
+		const bool readsPage0 = getShapeList(color, zoom)->maxColor > 0x10;
+		DrawCmd *dc = addDrawCmd(_curPage1, DC_SHAPE, readsPage0);
+		dc->color = color;
+		dc->zoom = zoom;
+		dc->offset = offset;
+		dc->x = pt.x;
+		dc->y = pt.y;
+		dc->dataBuf = dataBuf;
+	} else {
+		ownPage(_curPage1, false);
+		renderShape(color, zoom, pt);
+	}
+}
+
+void Video::renderShape(uint8 color, uint16 zoom, const Point &pt) {
+	const uint16 offset = _pData.pc - _dataBuf;
+	SpanCache::Key k;
+	if (_spanCache._maxSize != 0) {
+		k.dataBuf = _dataBuf;
+		k.offset = offset;
+		k.zoom = zoom;
+		k.x = pt.x;
+		k.y = pt.y;
+		k.color = color;
+		const SpanCache::List *sl = _spanCache.find(k);
+		if (sl) {
+			drawSpans(sl);
+			return;
+		}
+		if (_spanCache.startRecording(k)) {
+			_spanRecorder = &_spanCache;
+		}
+	}
+	drawShapeList(getShapeList(color, zoom), zoom, pt);
+	if (_spanRecorder) {
+		_spanRecorder = 0;
+		_spanCache.stopRecording(k);
+	}
+}
+
+void Raster::drawShapeList(const ShapeCache::List *l, uint16 zoom, const Point &pt) {
+	for (int i = 0; i < l->numShapes; ++i) {
+		const ShapeCache::Shape *s = &l->shapes[i];
+		_pg.bbw = s->bbw;
+		_pg.bbh = s->bbh;
+		_pg.numPoints = s->numPoints;
+		const Point *p = l->points + s->firstPoint;
+		for (int j = 0; j < s->numPoints; ++j) {
+			_pg.points[j] = p[j];
+		}
+		fillPolygon(s->color, zoom, Point(pt.x + s->x, pt.y + s->y));
+	}
+}
+
+// the shapes at _pData, _pData is left unchanged
+const ShapeCache::List *Video::getShapeList(uint8 color, uint16 zoom) {
+	const uint16 offset = _pData.pc - _dataBuf;
+	const ShapeCache::List *l = _shapes.find(_dataBuf, offset, zoom, color);
+	if (!l) {
+		ShapeCache::List *nl = _shapes.add(_dataBuf, offset, zoom, color);
+		compileShape(nl, color, zoom, Point(0, 0));
+		_pData.pc = _dataBuf + offset;
+		l = nl;
+	}
+	return l;
+}
+
+void Video::drawSpans(const SpanCache::List *l) {
+	for (int i = 0; i < l->numSpans; ++i) {
+		const SpanCache::Span *s = &l->spans[i];
+		if (s->x2 == SpanCache::POINT) {
+			drawPoint(s->color, s->x1, s->y);
+			continue;
+		}
+		_hliney = s->y;
+		if (s->color < 0x10) {
+			drawLineN(s->x1, s->x2, s->color);
+		} else if (s->color > 0x10) {
+			drawLineP(s->x1, s->x2, s->color);
+		} else {
+			drawLineT(s->x1, s->x2, s->color);
+		}
+	}
+}
+
+// walks the shape hierarchy at _pData, the polygons are appended to the list
+void Video::compileShape(ShapeCache::List *l, uint8 color, uint16 zoom, const Point &pt) {
 	uint8 i = _pData.fetchByte();
 	if (i >= 0xC0) {
 		if (color & 0x80) {
 			color = i & 0x3F;
 		}
 		_pg.init(_pData.pc, zoom);
-		fillPolygon(color, zoom, pt);
+		_shapes.addShape(l, color, pt, &_pg);
 	} else {
 		i &= 0x3F;
 		if (i == 1) {
 			warning("Video::drawShape() ec=0x%X (i != 2)", 0xF80);
 		} else if (i == 2) {
-			drawShapeParts(zoom, pt);
+			compileShapeParts(l, zoom, pt);
 		} else {
 			warning("Video::drawShape() ec=0x%X (i != 2)", 0xFBB);
 		}
 	}
 }
 
-void Video::fillPolygon(uint16 color, uint16 zoom, const Point &pt) {
+inline void Raster::drawLineT(int16 x1, int16 x2, uint8 color) {
+	debug(DBG_VIDEO, "drawLineT(%d, %d, %d)", x1, x2, color);
+	int16 xmax = MAX(x1, x2);
+	int16 xmin = MIN(x1, x2);
+	markDirty(_curDirty1, xmin, _hliney, xmax, _hliney);
+	// sets the transparency bit
+	_spans->mask(_curPagePtr1 + _hliney * _pitch + xmin, 0x08, xmax - xmin + 1);
+}
+
+inline void Raster::drawLineN(int16 x1, int16 x2, uint8 color) {
+	debug(DBG_VIDEO, "drawLineN(%d, %d, %d)", x1, x2, color);
+	int16 xmax = MAX(x1, x2);
+	int16 xmin = MIN(x1, x2);
+	markDirty(_curDirty1, xmin, _hliney, xmax, _hliney);
+	_spans->fill(_curPagePtr1 + _hliney * _pitch + xmin, color & 0xF, xmax - xmin + 1);
+}
+
+inline void Raster::drawLineP(int16 x1, int16 x2, uint8 color) {
+	debug(DBG_VIDEO, "drawLineP(%d, %d, %d)", x1, x2, color);
+	int16 xmax = MAX(x1, x2);
+	int16 xmin = MIN(x1, x2);
+	markDirty(_curDirty1, xmin, _hliney, xmax, _hliney);
+	const uint32 off = _hliney * _pitch + xmin;
+	_spans->copy(_curPagePtr1 + off, _pagePtrs[0] + off, xmax - xmin + 1);
+}
+
+void Raster::fillPolygon(uint16 color, uint16 zoom, const Point &pt) {
 	if (_pg.bbw == 0 && _pg.bbh == 1 && _pg.numPoints == 4) {
+		if (_spanRecorder && pt.x >= 0 && pt.x <= 319 && pt.y >= 0 && pt.y <= 199) {
+			_spanRecorder->record(pt.x, SpanCache::POINT, pt.y, color);
+		}
 		drawPoint(color, pt.x, pt.y);
 		return;
 	}
-	
+	if (_hires) {
+		if (color < 0x10) {
+			fillPolygonHires<FILL_N>(color, pt);
+		} else if (color > 0x10) {
+			fillPolygonHires<FILL_P>(color, pt);
+		} else {
+			fillPolygonHires<FILL_T>(color, pt);
+		}
+		return;
+	}
+	if (color < 0x10) {
+		fillPolygon<FILL_N>(color, pt);
+	} else if (color > 0x10) {
+		fillPolygon<FILL_P>(color, pt);
+	} else {
+		fillPolygon<FILL_T>(color, pt);
+	}
+}
+
+template <int MODE>
+inline void Raster::drawSpan(int16 x1, int16 x2, uint8 color) {
+	if (_spanRecorder) {
+		_spanRecorder->record(x1, x2, _hliney, color);
+	}
+	switch (MODE) {
+	case FILL_N:
+		drawLineN(x1, x2, color);
+		break;
+	case FILL_P:
+		drawLineP(x1, x2, color);
+		break;
+	case FILL_T:
+		drawLineT(x1, x2, color);
+		break;
+	}
+}
+
+template <int MODE>
+void Raster::fillPolygon(uint8 color, const Point &pt) {
 	int16 x1 = pt.x - _pg.bbw / 2;
 	int16 x2 = pt.x + _pg.bbw / 2;
 	int16 y1 = pt.y - _pg.bbh / 2;
 	int16 y2 = pt.y + _pg.bbh / 2;
 
-	if (x1 > 319 || x2 < 0 || y1 > 199 || y2 < 0)
+	if (x1 > 319 || x2 < 0 || y1 >= _clipY2 || y2 < _clipY1)
 		return;
 
 	_hliney = y1;
@@ -103,15 +353,6 @@ void Video::fillPolygon(uint16 color, uint16 zoom, const Point &pt) {
 	++i;
 	--j;
 
-	drawLine pdl;
-	if (color < 0x10) {
-		pdl = &Video::drawLineN;
-	} else if (color > 0x10) {
-		pdl = &Video::drawLineP;
-	} else {
-		pdl = &Video::drawLineT;
-	}
-
 	uint32 cpt1 = x1 << 16;
 	uint32 cpt2 = x2 << 16;
 
@@ -133,32 +374,95 @@ void Video::fillPolygon(uint16 color, uint16 zoom, const Point &pt) {
 		if (h == 0) {	
 			cpt1 += step1;
 			cpt2 += step2;
+			continue;
+		}
+		// the rows above the clipped rows only move the edges
+		if (_hliney < _clipY1) {
+			uint16 n = MIN(h, (uint16)(_clipY1 - _hliney));
+			cpt1 += (uint32)step1 * n;
+			cpt2 += (uint32)step2 * n;
+			_hliney += n;
+			h -= n;
+		}
+		if (h == 0) {
+			continue;
+		}
+		// the edges are straight, no clipping is needed if both ends of the
+		// section lie within the page and the clipped rows
+		const int64 last1 = (int64)(int32)cpt1 + (int64)step1 * (h - 1);
+		const int64 last2 = (int64)(int32)cpt2 + (int64)step2 * (h - 1);
+		if ((int32)cpt1 >= 0 && (int32)cpt1 < (320 << 16) && last1 >= 0 && last1 < (320 << 16) &&
+			(int32)cpt2 >= 0 && (int32)cpt2 < (320 << 16) && last2 >= 0 && last2 < (320 << 16) &&
+			_hliney + h <= _clipY2) {
+			for (; h != 0; --h) {
+				drawSpan<MODE>(cpt1 >> 16, cpt2 >> 16, color);
+				cpt1 += step1;
+				cpt2 += step2;
+				++_hliney;
+			}
+			if (_hliney >= _clipY2) return;
 		} else {
 			for (; h != 0; --h) {
-				if (_hliney >= 0) {
-					x1 = cpt1 >> 16;
-					x2 = cpt2 >> 16;
-					if (x1 <= 319 && x2 >= 0) {
-						if (x1 < 0) x1 = 0;
-						if (x2 > 319) x2 = 319;
-						(this->*pdl)(x1, x2, color);
-					}
+				x1 = cpt1 >> 16;
+				x2 = cpt2 >> 16;
+				if (x1 <= 319 && x2 >= 0) {
+					if (x1 < 0) x1 = 0;
+					if (x2 > 319) x2 = 319;
+					drawSpan<MODE>(x1, x2, color);
 				}
 				cpt1 += step1;
 				cpt2 += step2;
 				++_hliney;					
-				if (_hliney > 199) return;
+				if (_hliney >= _clipY2) return;
 			}
 		}
 	}
 }
 
-void Video::drawShapeParts(uint16 zoom, const Point &pgc) {
+// rasterizes the polygon at the page resolution, the edges of each section
+// are sampled at the center of the page rows
+template <int MODE>
+void Raster::fillPolygonHires(uint8 color, const Point &pt) {
+	const int16 x1 = pt.x - _pg.bbw / 2;
+	const int16 y1 = pt.y - _pg.bbh / 2;
+	if (x1 > 319 || pt.x + _pg.bbw / 2 < 0 || y1 > 199 || pt.y + _pg.bbh / 2 < 0)
+		return;
+
+	for (int i = 0, j = _pg.numPoints - 1; i + 1 < j; ++i, --j) {
+		const Point *l1 = &_pg.points[j];
+		const Point *l2 = &_pg.points[j - 1];
+		const Point *r1 = &_pg.points[i];
+		const Point *r2 = &_pg.points[i + 1];
+		const int16 h = r2->y - r1->y;
+		if (h <= 0) {
+			continue;
+		}
+		const int16 hl = (l2->y != l1->y) ? l2->y - l1->y : 1;
+		const int16 ya = y1 + r1->y - _pg.points[0].y;
+		const int16 yb = MIN(toPageY((ya + h) * 0x10000), _clipY2);
+		for (int16 y = MAX(toPageY(ya * 0x10000), _clipY1); y < yb; ++y) {
+			// offset from the first game row of the section
+			const int64 t = ((int64)(2 * y + 1) * VID_PAGE_H << 16) / (2 * _h) - 0x8000 - ya * 0x10000;
+			const int32 xl = (x1 + l1->x) * 0x10000 + (l2->x - l1->x) * t / hl;
+			const int32 xr = (x1 + r1->x) * 0x10000 + (r2->x - r1->x) * t / h;
+			int16 xa = toPageX(MIN(xl, xr));
+			int16 xb = toPageX(MAX(xl, xr) + 0x10000) - 1;
+			if (xa < 0) xa = 0;
+			if (xb >= _w) xb = _w - 1;
+			if (xa <= xb) {
+				_hliney = y;
+				drawSpan<MODE>(xa, xb, color);
+			}
+		}
+	}
+}
+
+void Video::compileShapeParts(ShapeCache::List *l, uint16 zoom, const Point &pgc) {
 	Point pt(pgc);
 	pt.x -= _pData.fetchByte() * zoom / 64;
 	pt.y -= _pData.fetchByte() * zoom / 64;
 	int16 n = _pData.fetchByte();
-	debug(DBG_VIDEO, "Video::drawShapeParts n=%d", n);
+	debug(DBG_VIDEO, "Video::compileShapeParts n=%d", n);
 	for ( ; n >= 0; --n) {
 		uint16 off = _pData.fetchWord();
 		Point po(pt);
@@ -173,19 +477,37 @@ void Video::drawShapeParts(uint16 zoom, const Point &pgc) {
 		}
 		uint8 *bak = _pData.pc;
 		_pData.pc = _dataBuf + off * 2;
-		drawShape(color, zoom, po);
+		compileShape(l, color, zoom, po);
 		_pData.pc = bak;
 	}
 }
 
-int32 Video::calcStep(const Point &p1, const Point &p2, uint16 &dy) {
+int32 Raster::calcStep(const Point &p1, const Point &p2, uint16 &dy) {
 	dy = p2.y - p1.y;
 	return (p2.x - p1.x) * _interpTable[dy] * 4;
 }
 
 void Video::drawString(uint8 color, uint16 x, uint16 y, uint16 strId) {
-	const StrEntry *se = _stringsTableEng;
-	while (se->id != 0xFFFF && se->id != strId) ++se;
+	if (_trace) {
+		_trace->writeString(color, x, y, strId);
+	}
+	if (_deferred) {
+		DrawCmd *dc = addDrawCmd(_curPage1, DC_STRING, false);
+		dc->color = color;
+		dc->offset = strId;
+		dc->x = x;
+		dc->y = y;
+	} else {
+		ownPage(_curPage1, false);
+		renderString(color, x, y, strId);
+	}
+}
+
+void Raster::renderString(uint8 color, uint16 x, uint16 y, uint16 strId) {
+	const StrEntry *se = (strId < MAX_STRING_IDS) ? _stringsIndex[strId] : 0;
+	if (!se) {
+		return;
+	}
 	debug(DBG_VIDEO, "drawString(%d, %d, %d, '%s')", color, x, y, se->str);
 	uint16 xx = x;
 	int len = strlen(se->str);
@@ -194,254 +516,600 @@ void Video::drawString(uint8 color, uint16 x, uint16 y, uint16 strId) {
 			y += 8;
 			x = xx;
 		} else {
-			drawChar(se->str[i], x, y, color, _curPagePtr1);
+			drawChar(se->str[i], x, y, color);
 			++x;
 		}
 	}
 }
 
-void Video::drawChar(uint8 c, uint16 x, uint16 y, uint8 color, uint8 *buf) {
+void Raster::drawChar(uint8 c, uint16 x, uint16 y, uint8 color) {
 	if (x <= 39 && y <= 192) {
-		const uint8 *ft = _font + (c - 0x20) * 8;
-		uint8 *p = buf + x * 4 + y * 160;
-		for (int j = 0; j < 8; ++j) {
-			uint8 ch = *(ft + j);
-			for (int i = 0; i < 4; ++i) {
-				uint8 b = *(p + i);
-				uint8 cmask = 0xFF;
-				uint8 colb = 0;
-				if (ch & 0x80) {
-					colb |= color << 4;
-					cmask &= 0x0F;
-				}
-				ch <<= 1;
-				if (ch & 0x80) {
-					colb |= color;
-					cmask &= 0xF0;
+		const uint8 *ft = Video::_font + (c - 0x20) * 8;
+		if (_hires) {
+			// each pixel of the font covers the page pixels of the game pixel
+			const int16 cy1 = MAX(toPageY(y << 16), _clipY1);
+			const int16 cy2 = MIN(toPageY((y + 8) << 16), _clipY2);
+			if (cy1 >= cy2) {
+				return;
+			}
+			markDirty(_curDirty1, toPageX((x * 8) << 16), cy1, toPageX((x * 8 + 8) << 16) - 1, cy2 - 1);
+			for (int j = 0; j < 8; ++j) {
+				const int16 y1 = MAX(toPageY((y + j) << 16), _clipY1);
+				const int16 y2 = MIN(toPageY((y + j + 1) << 16), _clipY2);
+				const uint8 ch = *(ft + j);
+				// the runs of pixels set in the row are filled at once
+				int i = 0;
+				while (i < 8) {
+					if (!(ch & (0x80 >> i))) {
+						++i;
+						continue;
+					}
+					const int i1 = i;
+					while (i < 8 && (ch & (0x80 >> i))) {
+						++i;
+					}
+					const int16 x1 = toPageX((x * 8 + i1) << 16);
+					const int16 x2 = toPageX((x * 8 + i) << 16);
+					for (int16 yy = y1; yy < y2; ++yy) {
+						_spans->fill(_curPagePtr1 + yy * _pitch + x1, color & 0xF, x2 - x1);
+					}
 				}
-				ch <<= 1;
-				*(p + i) = (b & cmask) | colb;
 			}
-			p += 160;
+			return;
+		}
+		const int16 y1 = MAX((int16)y, _clipY1);
+		const int16 y2 = MIN((int16)(y + 8), _clipY2);
+		if (y1 >= y2) {
+			return;
+		}
+		uint8 *p = _curPagePtr1 + x * 8 + y1 * _pitch;
+		markDirty(_curDirty1, x * 8, y1, x * 8 + 7, y2 - 1);
+		// the glyph rows are 8 pixels, one masked store each
+		const uint64 *masks = _fontMasks + (c - 0x20) * 8;
+		const uint64 colors = (color & 0xF) * 0x0101010101010101ULL;
+		for (int j = y1 - y; j < y2 - y; ++j) {
+			uint64 row;
+			memcpy(&row, p, 8);
+			row = (row & ~masks[j]) | (colors & masks[j]);
+			memcpy(p, &row, 8);
+			p += _pitch;
 		}
 	}
 }
 
-void Video::drawPoint(uint8 color, int16 x, int16 y) {
+void Raster::drawPoint(uint8 color, int16 x, int16 y) {
 	debug(DBG_VIDEO, "drawPoint(%d, %d, %d)", color, x, y);
 	if (x >= 0 && x <= 319 && y >= 0 && y <= 199) {
-		uint16 off = y * 160 + x / 2;
-	
-		uint8 cmasko, cmaskn;
-		if (x & 1) {
-			cmaskn = 0x0F;
-			cmasko = 0xF0;
-		} else {
-			cmaskn = 0xF0;
-			cmasko = 0x0F;
+		// the packed pages merged the upper bits of the color in the left pixel
+		const uint8 c = (x & 1) ? (color & 0xF) : ((color | (color >> 4)) & 0xF);
+		if (_hires) {
+			const int16 x1 = toPageX(x << 16);
+			const int16 x2 = toPageX((x + 1) << 16) - 1;
+			const int16 y2 = MIN(toPageY((y + 1) << 16), _clipY2);
+			for (_hliney = MAX(toPageY(y << 16), _clipY1); _hliney < y2; ++_hliney) {
+				if (color == 0x10) {
+					drawLineT(x1, x2, color);
+				} else if (color == 0x11) {
+					drawLineP(x1, x2, color);
+				} else {
+					drawLineN(x1, x2, c);
+				}
+			}
+			return;
 		}
-
-		uint8 colb = (color << 4) | color;
+		if (y < _clipY1 || y >= _clipY2) {
+			return;
+		}
+		const uint32 off = y * _pitch + x;
 		if (color == 0x10) {
-			cmaskn &= 0x88;
-			cmasko = ~cmaskn;
-			colb = 0x88;		
+			*(_curPagePtr1 + off) |= 0x08;
 		} else if (color == 0x11) {
-			colb = *(_pagePtrs[0] + off);
+			*(_curPagePtr1 + off) = *(_pagePtrs[0] + off);
+		} else {
+			*(_curPagePtr1 + off) = c;
 		}
-		uint8 b = *(_curPagePtr1 + off);
-		*(_curPagePtr1 + off) = (b & cmasko) | (colb & cmaskn);
+		markDirty(_curDirty1, x, y, x, y);
 	}
 }
 
-void Video::drawLineT(int16 x1, int16 x2, uint8 color) {
-	debug(DBG_VIDEO, "drawLineT(%d, %d, %d)", x1, x2, color);
-	int16 xmax = MAX(x1, x2);
-	int16 xmin = MIN(x1, x2);
-	uint8 *p = _curPagePtr1 + _hliney * 160 + xmin / 2;
-
-	uint16 w = xmax / 2 - xmin / 2 + 1;
-	uint8 cmaske = 0;
-	uint8 cmasks = 0;	
-	if (xmin & 1) {
-		--w;
-		cmasks = 0xF7;
+uint8 Video::getPageNum(uint8 page) {
+	uint8 num;
+	if (page <= 3) {
+		num = page;
+	} else {
+		switch (page) {
+		case 0xFF:
+			num = _curPage3;
+			break;
+		case 0xFE:
+			num = _curPage2;
+			break;
+		default:
+			num = 0; // XXX check
+			warning("Video::getPageNum() p != [0,1,2,3,0xFF,0xFE] == 0x%X", page);
+			break;
+		}
 	}
-	if (!(xmax & 1)) {
-		--w;
-		cmaske = 0x7F;
+	return num;
+}
+
+void Video::changePagePtr1(uint8 page) {
+	debug(DBG_VIDEO, "Video::changePagePtr1(%d)", page);
+	if (_trace) {
+		_trace->writePage1(page);
 	}
+	_curPage1 = getPageNum(page);
+	_curPagePtr1 = _pagePtrs[_curPage1];
+	_curDirty1 = _dirtyMasks[_curPage1];
+}
 
-	if (cmasks != 0) {
-		*p = (*p & cmasks) | 0x08;
-		++p;
+Video::DrawCmd *Video::addDrawCmd(uint8 num, uint8 type, bool readsPage0) {
+	if (num == 0) {
+		resolvePage0Readers();
+	} else if (readsPage0) {
+		resolveDrawList(0);
 	}
-	while (w--) {
-		*p = (*p & 0x77) | 0x88;
-		++p;
+	DrawList *dl = &_drawLists[num];
+	if (dl->numCmds == MAX_DRAW_CMDS) {
+		resolveDrawList(num);
+	}
+	dl->readsPage0 |= readsPage0;
+	DrawCmd *dc = &dl->cmds[dl->numCmds++];
+	dc->type = type;
+	return dc;
+}
+
+// draws the pending commands of a page before it is read
+void Video::resolveDrawList(uint8 num) {
+	DrawList *dl = &_drawLists[num];
+	if (dl->numCmds == 0) {
+		return;
 	}
-	if (cmaske != 0) {
-		*p = (*p & cmaske) | 0x80;
-		++p;
+	debug(DBG_VIDEO, "Video::resolveDrawList(%d) %d commands", num, dl->numCmds);
+	// a fill is always the first command of its list
+	ownPage(num, dl->cmds[0].type == DC_FILL);
+	if (_numBands != 0 && _spanCache._maxSize == 0) {
+		rasterizeDrawList(num);
+	} else {
+		_curPagePtr1 = _pagePtrs[num];
+		_curDirty1 = _dirtyMasks[num];
+		for (int i = 0; i < dl->numCmds; ++i) {
+			const DrawCmd *dc = &dl->cmds[i];
+			switch (dc->type) {
+			case DC_FILL:
+				clearPage(_curPagePtr1, dc->color);
+				markAllDirty(_curDirty1);
+				break;
+			case DC_SHAPE:
+				setDataBuffer(dc->dataBuf, dc->offset);
+				renderShape(dc->color, dc->zoom, Point(dc->x, dc->y));
+				break;
+			case DC_STRING:
+				renderString(dc->color, dc->x, dc->y, dc->offset);
+				break;
+			}
+		}
+		_curPagePtr1 = _pagePtrs[_curPage1];
+		_curDirty1 = _dirtyMasks[_curPage1];
 	}
+	dl->numCmds = 0;
+	dl->readsPage0 = false;
 }
 
-void Video::drawLineN(int16 x1, int16 x2, uint8 color) {
-	debug(DBG_VIDEO, "drawLineN(%d, %d, %d)", x1, x2, color);
-	int16 xmax = MAX(x1, x2);
-	int16 xmin = MIN(x1, x2);
-	uint8 *p = _curPagePtr1 + _hliney * 160 + xmin / 2;
+// the commands are binned to the bands of rows they touch, the workers then
+// draw the bands, each one in the order of the list. The bands only read
+// page 0 at their own rows, so the result does not depend on the threads.
+void Video::rasterizeDrawList(uint8 num) {
+	const DrawList *dl = &_drawLists[num];
+	_bandList = dl;
+	for (int b = 0; b < _numBands; ++b) {
+		Raster *r = &_bands[b].raster;
+		*r = *this;
+		r->_curPagePtr1 = _pagePtrs[num];
+		r->_curDirty1 = _dirtyMasks[num];
+		r->_clipY1 = b << _dirtyShiftY;
+		r->_clipY2 = MIN((b + 1) << _dirtyShiftY, (int)_h);
+	}
+	uint16 i = 0;
+	while (i < dl->numCmds) {
+		for (int b = 0; b < _numBands; ++b) {
+			_bands[b].numCmds = 0;
+		}
+		// the shape lists binned must stay in the cache until the bands are drawn
+		int numShapes = 0;
+		for (; i < dl->numCmds && numShapes < ShapeCache::MAX_LISTS - 1; ++i) {
+			const DrawCmd *dc = &dl->cmds[i];
+			if (dc->type == DC_SHAPE) {
+				setDataBuffer(dc->dataBuf, dc->offset);
+				const ShapeCache::List *l = getShapeList(dc->color, dc->zoom);
+				_bandShapes[i] = l;
+				++numShapes;
+				if (l->numShapes != 0) {
+					binDrawCmd(i, toPageY((dc->y + l->minY) * 0x10000), toPageY((dc->y + l->maxY + 1) * 0x10000) - 1);
+				}
+			} else {
+				binDrawCmd(i, 0, _h - 1);
+			}
+		}
+		_rasterPool.run(drawBandJob, this, _numBands);
+	}
+}
 
-	uint16 w = xmax / 2 - xmin / 2 + 1;
-	uint8 cmaske = 0;
-	uint8 cmasks = 0;	
-	if (xmin & 1) {
-		--w;
-		cmasks = 0xF0;
+void Video::binDrawCmd(uint16 i, int16 y1, int16 y2) {
+	if (y2 < 0 || y1 >= _h) {
+		return;
 	}
-	if (!(xmax & 1)) {
-		--w;
-		cmaske = 0x0F;
+	const int b1 = MAX(y1, (int16)0) >> _dirtyShiftY;
+	const int b2 = MIN(y2, (int16)(_h - 1)) >> _dirtyShiftY;
+	for (int b = b1; b <= b2; ++b) {
+		RasterBand *band = &_bands[b];
+		band->cmds[band->numCmds++] = i;
 	}
+}
 
-	uint8 colb = ((color & 0xF) << 4) | (color & 0xF);	
-	if (cmasks != 0) {
-		*p = (*p & cmasks) | (colb & 0x0F);
-		++p;
+void Video::drawBand(RasterBand *band) {
+	Raster *r = &band->raster;
+	for (int n = 0; n < band->numCmds; ++n) {
+		const uint16 i = band->cmds[n];
+		const DrawCmd *dc = &_bandList->cmds[i];
+		switch (dc->type) {
+		case DC_FILL:
+			r->fillRows(dc->color);
+			break;
+		case DC_SHAPE:
+			r->drawShapeList(_bandShapes[i], dc->zoom, Point(dc->x, dc->y));
+			break;
+		case DC_STRING:
+			r->renderString(dc->color, dc->x, dc->y, dc->offset);
+			break;
+		}
 	}
-	while (w--) {
-		*p++ = colb;
+}
+
+void Video::drawBandJob(void *param, int job) {
+	Video *vid = (Video *)param;
+	vid->drawBand(&vid->_bands[job]);
+}
+
+void Video::resolveDrawLists() {
+	for (int i = 0; i < 4; ++i) {
+		resolveDrawList(i);
 	}
-	if (cmaske != 0) {
-		*p = (*p & cmaske) | (colb & 0xF0);
-		++p;		
+}
+
+// the lists reading page 0 are resolved before it changes, page 0 has then
+// no pending commands while another list reads it
+void Video::resolvePage0Readers() {
+	for (int i = 1; i < 4; ++i) {
+		if (_drawLists[i].readsPage0) {
+			resolveDrawList(i);
+		}
 	}
 }
 
-void Video::drawLineP(int16 x1, int16 x2, uint8 color) {
-	debug(DBG_VIDEO, "drawLineP(%d, %d, %d)", x1, x2, color);
-	int16 xmax = MAX(x1, x2);
-	int16 xmin = MIN(x1, x2);
-	uint16 off = _hliney * 160 + xmin / 2;
-	uint8 *p = _curPagePtr1 + off;
-	uint8 *q = _pagePtrs[0] + off;
+void Video::dropDrawList(uint8 num) {
+	DrawList *dl = &_drawLists[num];
+	if (dl->numCmds != 0) {
+		debug(DBG_VIDEO, "Video::dropDrawList(%d) %d commands", num, dl->numCmds);
+	}
+	dl->numCmds = 0;
+	dl->readsPage0 = false;
+}
 
-	uint8 w = xmax / 2 - xmin / 2 + 1;
-	uint8 cmaske = 0;
-	uint8 cmasks = 0;	
-	if (xmin & 1) {
-		--w;
-		cmasks = 0xF0;
+// called before a page is read, its pending commands and scroll are applied
+void Video::beginPageRead(uint8 num) {
+	if (_deferred) {
+		resolveDrawList(num);
 	}
-	if (!(xmax & 1)) {
-		--w;
-		cmaske = 0x0F;
+	if (_pageScrolls[num].buf != NO_PAGE_BUF) {
+		ownPage(num, false);
 	}
+}
 
-	if (cmasks != 0) {
-		*p = (*p & cmasks) | (*q & 0x0F);
-		++p;
-		++q;
+// called before a page is replaced or scrolled, the pending commands and
+// scroll are dropped if the whole page is overwritten
+void Video::beginPageWrite(uint8 num, bool whole) {
+	if (_deferred) {
+		if (num == 0) {
+			resolvePage0Readers();
+		}
+		if (whole) {
+			dropDrawList(num);
+		} else {
+			resolveDrawList(num);
+		}
 	}
-	while (w--) {
-		*p++ = *q++;			
+	if (whole) {
+		dropPageScroll(num);
+	} else if (_pageScrolls[num].buf != NO_PAGE_BUF) {
+		ownPage(num, false);
 	}
-	if (cmaske != 0) {
-		*p = (*p & cmaske) | (*q & 0xF0);
-		++p;
-		++q;
+}
+
+void Video::dropPageScroll(uint8 num) {
+	PageScroll *ps = &_pageScrolls[num];
+	if (ps->buf != NO_PAGE_BUF) {
+		--_pageBufRefs[ps->buf];
+		ps->buf = NO_PAGE_BUF;
 	}
 }
 
-uint8 *Video::getPagePtr(uint8 page) {
-	uint8 *p;
-	if (page <= 3) {
-		p = _pagePtrs[page];
-	} else {
-		switch (page) {
-		case 0xFF:
-			p = _curPagePtr3;
-			break;
-		case 0xFE:
-			p = _curPagePtr2;
-			break;
-		default:
-			p = _pagePtrs[0]; // XXX check
-			warning("Video::getPagePtr() p != [0,1,2,3,0xFF,0xFE] == 0x%X", page);
-			break;
+uint8 Video::allocPageBuf() {
+	for (int i = 0; i < MAX_PAGE_BUFS; ++i) {
+		if (_pageBufRefs[i] == 0) {
+			if (!_pageBufs[i]) {
+				_pageBufs[i] = allocPage();
+			}
+			return i;
 		}
 	}
-	return p;
+	error("Video::allocPageBuf() no free buffer");
+	return 0;
 }
 
-void Video::changePagePtr1(uint8 page) {
-	debug(DBG_VIDEO, "Video::changePagePtr1(%d)", page);
-	_curPagePtr1 = getPagePtr(page);
+void Video::setPageBuf(uint8 num, uint8 buf) {
+	++_pageBufRefs[buf];
+	--_pageBufRefs[_pageBufNums[num]];
+	_pageBufNums[num] = buf;
+	_pagePtrs[num] = _pageBufs[buf];
+	if (num == _curPage1) {
+		_curPagePtr1 = _pagePtrs[num];
+	}
+}
+
+// gives the page its own buffer before its pixels are written, the buffer
+// shared with the copies of the page is cloned unless the whole page is
+// overwritten. The pending scroll is then applied.
+void Video::ownPage(uint8 num, bool whole) {
+	if (whole) {
+		dropPageScroll(num);
+	}
+	PageScroll *ps = &_pageScrolls[num];
+	const uint8 buf = _pageBufNums[num];
+	if (_pageBufRefs[buf] > 1) {
+		const uint8 clone = allocPageBuf();
+		if (!whole) {
+			// the rows written by the scroll are not cloned
+			int16 y1 = 0, y2 = _h;
+			if (ps->buf != NO_PAGE_BUF) {
+				if (ps->dy < 0) {
+					y1 = _h + ps->dy;
+				} else {
+					y2 = ps->dy;
+				}
+			}
+			memcpy(_pageBufs[clone] + y1 * _pitch, _pageBufs[buf] + y1 * _pitch, (y2 - y1) * _pitch);
+		}
+		debug(DBG_VIDEO, "Video::ownPage(%d) buffer %d cloned to %d", num, buf, clone);
+		setPageBuf(num, clone);
+	}
+	if (ps->buf != NO_PAGE_BUF) {
+		const uint8 *p = _pageBufs[ps->buf];
+		uint8 *q = _pagePtrs[num];
+		uint16 h = _h;
+		if (ps->dy < 0) {
+			h += ps->dy;
+			p += -ps->dy * _pitch;
+		} else {
+			h -= ps->dy;
+			q += ps->dy * _pitch;
+		}
+		memcpy(q, p, h * _pitch);
+		dropPageScroll(num);
+	}
+}
+
+// fills the clipped rows of the current page
+void Raster::fillRows(uint8 color) {
+	memset(_curPagePtr1 + _clipY1 * _pitch, color & 0xF, (_clipY2 - _clipY1) * _pitch);
+	for (int y = _clipY1 >> _dirtyShiftY; y <= (_clipY2 - 1) >> _dirtyShiftY; ++y) {
+		_curDirty1[y] = DIRTY_ALL;
+	}
+}
+
+void Video::clearPage(uint8 *p, uint8 color) {
+	memset(p, color & 0xF, _pageSize);
 }
 
 void Video::fillPage(uint8 page, uint8 color) {
 	debug(DBG_VIDEO, "Video::fillPage(%d, %d)", page, color);
-	uint8 *p = getPagePtr(page);
-	uint8 c = (color << 4) | color;
-	memset(p, c, VID_PAGE_SIZE);
+	if (_trace) {
+		_trace->writeFill(page, color);
+	}
+	const uint8 num = getPageNum(page);
+	if (_deferred) {
+		dropDrawList(num);
+		DrawCmd *dc = addDrawCmd(num, DC_FILL, false);
+		dc->color = color;
+		return;
+	}
+	ownPage(num, true);
+	clearPage(_pagePtrs[num], color);
+	markAllDirty(_dirtyMasks[num]);
 }
 
 void Video::copyPage(uint8 src, uint8 dst, int16 vscroll) {
 	debug(DBG_VIDEO, "Video::copyPage(%d, %d)", src, dst);
+	if (_trace) {
+		_trace->writeCopy(src, dst, vscroll);
+	}
 	if (src >= 0xFE || !((src &= 0xBF) & 0x80)) {
-		uint8 *p = getPagePtr(src);
-		uint8 *q = getPagePtr(dst);
+		const uint8 p = getPageNum(src);
+		const uint8 q = getPageNum(dst);
 		if (p != q) {
-			memcpy(q, p, VID_PAGE_SIZE);
+			// the pages share the buffer until one of them is written
+			beginPageRead(p);
+			beginPageWrite(q, true);
+			setPageBuf(q, _pageBufNums[p]);
+			memcpy(_dirtyMasks[q], _dirtyMasks[p], DIRTY_ROWS * sizeof(uint32));
 		}		
 	} else {
-		uint8 *p = getPagePtr(src & 3);
-		uint8 *q = getPagePtr(dst);
+		const uint8 p = getPageNum(src & 3);
+		const uint8 q = getPageNum(dst);
 		if (p != q && vscroll >= -199 && vscroll <= 199) {
-			uint16 h = 200;
-			if (vscroll < 0) {
-				h += vscroll;
-				p += -vscroll * 160;
+			markAllDirty(_dirtyMasks[q]);
+			const int16 dy = (vscroll < 0) ? -toPageY(-vscroll * 0x10000) : toPageY(vscroll * 0x10000);
+			beginPageRead(p);
+			beginPageWrite(q, dy == 0);
+			if (dy == 0) {
+				setPageBuf(q, _pageBufNums[p]);
 			} else {
-				h -= vscroll;
-				q += vscroll * 160;
+				// the source buffer is kept until the scroll is applied
+				PageScroll *ps = &_pageScrolls[q];
+				ps->buf = _pageBufNums[p];
+				ps->dy = dy;
+				++_pageBufRefs[ps->buf];
+				if (q == 0) {
+					// page 0 is read by the polygons copying it
+					ownPage(0, false);
+				}
 			}
-			memcpy(q, p, h * 160);
 		}
 	}
 }
 
 void Video::copyPagePtr(const uint8 *src) {
 	debug(DBG_VIDEO, "Video::copyPagePtr()");
-	uint8 *dst = _pagePtrs[0];
-	int h = 200;
-	while (h--) {
-		int w = 40;
-		while (w--) {
-			uint8 p[] = {
-				*(src + 8000 * 3),
-				*(src + 8000 * 2),
-				*(src + 8000 * 1),
-				*(src + 8000 * 0)
-			};
-			for(int j = 0; j < 4; ++j) {
-				uint8 acc = 0;
-				for (int i = 0; i < 8; ++i) {
-					acc <<= 1;
-					acc |= (p[i & 3] & 0x80) ? 1 : 0;
-					p[i & 3] <<= 1;
-				}
-				*dst++ = acc;
-			}
-			++src;
+	if (_trace) {
+		_trace->writeBackground(src);
+	}
+	beginPageWrite(0, true);
+	ownPage(0, true);
+	markAllDirty(_dirtyMasks[0]);
+	uint8 row[VID_PAGE_W];
+	for (int y = 0; y < VID_PAGE_H; ++y) {
+		if (_hires) {
+			_spans->planar(row, src, 8000, VID_PAGE_W);
+			expandRow(_pagePtrs[0], y, row);
+		} else {
+			_spans->planar(_pagePtrs[0] + y * _pitch, src, 8000, VID_PAGE_W);
+		}
+		src += VID_PAGE_W / 8;
+	}
+}
+
+// page 0 shares the background of the resource entry if it is cached
+bool Video::loadCachedPage(uint16 resNum) {
+	if (_pageCache._maxPages == 0) {
+		return false;
+	}
+	const uint8 buf = _pageCache.find(resNum);
+	if (buf == NO_PAGE_BUF) {
+		return false;
+	}
+	debug(DBG_VIDEO, "Video::loadCachedPage(%d) buffer %d", resNum, buf);
+	if (_trace) {
+		_trace->writeCachedBackground(resNum);
+	}
+	beginPageWrite(0, true);
+	setPageBuf(0, buf);
+	markAllDirty(_dirtyMasks[0]);
+	return true;
+}
+
+// keeps the background just converted by copyPagePtr()
+void Video::cachePage(uint16 resNum) {
+	if (_pageCache._maxPages != 0) {
+		if (_trace) {
+			_trace->writeCacheBackground(resNum);
+		}
+		const uint8 buf = _pageBufNums[0];
+		++_pageBufRefs[buf];
+		const uint8 evicted = _pageCache.add(resNum, buf);
+		if (evicted != NO_PAGE_BUF) {
+			--_pageBufRefs[evicted];
 		}
 	}
 }
 
 uint8 *Video::allocPage() {
-	uint8 *buf = (uint8 *)malloc(VID_PAGE_SIZE);
-	memset(buf, 0, VID_PAGE_SIZE);
-	return buf;
+	void *buf = 0;
+	if (posix_memalign(&buf, 64, _pageSize) != 0) {
+		error("Video::allocPage() unable to allocate %lu bytes", _pageSize);
+	}
+	memset(buf, 0, _pageSize);
+	return (uint8 *)buf;
+}
+
+// writes a game row to the page rows covering it
+void Video::expandRow(uint8 *page, int16 y, const uint8 *src) {
+	const int16 y1 = toPageY(y << 16);
+	const int16 y2 = toPageY((y + 1) << 16);
+	uint8 *dst = page + y1 * _pitch;
+	for (int x = 0; x < _w; ++x) {
+		*(dst + x) = *(src + (2 * x + 1) * VID_PAGE_W / (2 * _w));
+	}
+	for (int i = y1 + 1; i < y2; ++i) {
+		memcpy(page + i * _pitch, dst, _w);
+	}
+}
+
+// the save files keep the pages at 320x200 with two pixels per byte
+void Video::packPage(uint8 *dst, const uint8 *src) {
+	for (int y = 0; y < VID_PAGE_H; ++y) {
+		const uint8 *p = src + toPageY(y << 16) * _pitch;
+		for (int x = 0; x < VID_PAGE_W; x += 2) {
+			*dst++ = (*(p + toPageX(x << 16)) << 4) | *(p + toPageX((x + 1) << 16));
+		}
+	}
+}
+
+void Video::unpackPage(uint8 *dst, const uint8 *src) {
+	uint8 row[VID_PAGE_W];
+	for (int y = 0; y < VID_PAGE_H; ++y) {
+		for (int x = 0; x < VID_PAGE_W; x += 2) {
+			row[x] = *src >> 4;
+			row[x + 1] = *src & 0xF;
+			++src;
+		}
+		expandRow(dst, y, row);
+	}
+}
+
+void Raster::markAllDirty(uint32 *mask) {
+	for (int y = 0; y <= (_h - 1) >> _dirtyShiftY; ++y) {
+		mask[y] = DIRTY_ALL;
+	}
+}
+
+// converts the dirty blocks to rectangles, runs of blocks spanning the same
+// columns on consecutive rows are merged
+uint16 Video::getDirtyRects(const uint32 *mask) {
+	uint16 count = 0;
+	for (int y = 0; y < DIRTY_ROWS; ++y) {
+		uint16 curRow = count;
+		uint32 bits = mask[y];
+		int x = 0;
+		while (bits != 0) {
+			while (!(bits & 1)) {
+				bits >>= 1;
+				++x;
+			}
+			int x0 = x;
+			while (bits & 1) {
+				bits >>= 1;
+				++x;
+			}
+			Rect r;
+			r.x = x0 << _dirtyShiftX;
+			r.y = y << _dirtyShiftY;
+			if (r.x >= _w || r.y >= _h) {
+				continue;
+			}
+			r.w = MIN((x - x0) << _dirtyShiftX, _w - r.x);
+			r.h = MIN(1 << _dirtyShiftY, _h - r.y);
+			int i = 0;
+			while (i < curRow && !(_dirtyRects[i].x == r.x && _dirtyRects[i].w == r.w && _dirtyRects[i].y + _dirtyRects[i].h == r.y)) {
+				++i;
+			}
+			if (i < curRow) {
+				_dirtyRects[i].h += r.h;
+			} else {
+				_dirtyRects[count++] = r;
+			}
+		}
+	}
+	return count;
 }
 
 void Video::changePal(uint8 palNum) {
@@ -458,52 +1126,95 @@ void Video::changePal(uint8 palNum) {
 		}
 		_stub->setPalette(0, 16, pal);
 		_curPal = palNum;
+		// the whole screen is converted again with the new palette
+		for (int i = 0; i < 4; ++i) {
+			markAllDirty(_dirtyMasks[i]);
+		}
 	}
 }
 
 void Video::updateDisplay(uint8 page) {
 	debug(DBG_VIDEO, "Video::updateDisplay(%d)", page);
+	const uint8 newPal = _newPal;
 	if (page != 0xFE) {
 		if (page == 0xFF) {
-			SWAP(_curPagePtr2, _curPagePtr3);
+			SWAP(_curPage2, _curPage3);
 		} else {
-			_curPagePtr2 = getPagePtr(page);
+			_curPage2 = getPageNum(page);
 		}
 	}
 	if (_newPal != 0xFF) {
 		changePal(_newPal);
 		_newPal = 0xFF;
 	}
-	_stub->copyRect(0, 0, 320, 200, _curPagePtr2, 160);
+	beginPageRead(_curPage2);
+	uint32 *dirty = _dirtyMasks[_curPage2];
+	uint16 count = getDirtyRects(dirty);
+	_stub->copyRects(_dirtyRects, count, _pagePtrs[_curPage2], _pitch);
+	// the screen now differs from the other pages where it has been updated
+	for (int i = 0; i < 4; ++i) {
+		if (_dirtyMasks[i] != dirty) {
+			for (int y = 0; y < DIRTY_ROWS; ++y) {
+				_dirtyMasks[i][y] |= dirty[y];
+			}
+		}
+	}
+	memset(dirty, 0, DIRTY_ROWS * sizeof(uint32));
+	if (_trace) {
+		_trace->writeUpdate(page, newPal, getPageChecksum(_curPage2));
+	}
+}
+
+// hash of the rows of the page, render_bench compares it to the recording
+uint32 Video::getPageChecksum(uint8 num) {
+	beginPageRead(num);
+	uint32 h = 0;
+	for (int y = 0; y < _h; ++y) {
+		h = (hash32(_pagePtrs[num] + y * _pitch, _w) ^ (h * 31)) & 0xFFFFFFFF;
+	}
+	return h;
+}
+
+// the pages of a game state, packed as in the save files
+void Video::loadPages(const uint8 *packed, uint8 mask) {
+	_curPage2 = (mask >> 2) & 0x3;
+	_curPage3 = (mask >> 0) & 0x3;
+	changePagePtr1((mask >> 4) & 0x3);
+	for (int i = 0; i < 4; ++i) {
+		dropDrawList(i);
+		ownPage(i, true);
+		unpackPage(_pagePtrs[i], packed + i * VID_PAGE_PACKED_SIZE);
+		markAllDirty(_dirtyMasks[i]);
+	}
 }
 
 void Video::saveOrLoad(Serializer &ser) {
 	uint8 mask = 0;
+	uint8 *packed = (uint8 *)malloc(4 * VID_PAGE_PACKED_SIZE);
 	if (ser._mode == Serializer::SM_SAVE) {
 		for (int i = 0; i < 4; ++i) {
-			if (_pagePtrs[i] == _curPagePtr1)
-				mask |= i << 4;
-			if (_pagePtrs[i] == _curPagePtr2)
-				mask |= i << 2;
-			if (_pagePtrs[i] == _curPagePtr3)
-				mask |= i << 0;
-		}		
+			beginPageRead(i);
+			packPage(packed + i * VID_PAGE_PACKED_SIZE, _pagePtrs[i]);
+		}
+		mask = (_curPage1 << 4) | (_curPage2 << 2) | _curPage3;
 	}
 	Serializer::Entry entries[] = {
 		SE_INT(&_curPal, Serializer::SES_INT8, VER(1)),
 		SE_INT(&_newPal, Serializer::SES_INT8, VER(1)),
 		SE_INT(&mask, Serializer::SES_INT8, VER(1)),
-		SE_ARRAY(_pagePtrs[0], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1)),
-		SE_ARRAY(_pagePtrs[1], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1)),
-		SE_ARRAY(_pagePtrs[2], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1)),
-		SE_ARRAY(_pagePtrs[3], Video::VID_PAGE_SIZE, Serializer::SES_INT8, VER(1)),
+		SE_ARRAY(packed + 0 * VID_PAGE_PACKED_SIZE, Video::VID_PAGE_PACKED_SIZE, Serializer::SES_INT8, VER(1)),
+		SE_ARRAY(packed + 1 * VID_PAGE_PACKED_SIZE, Video::VID_PAGE_PACKED_SIZE, Serializer::SES_INT8, VER(1)),
+		SE_ARRAY(packed + 2 * VID_PAGE_PACKED_SIZE, Video::VID_PAGE_PACKED_SIZE, Serializer::SES_INT8, VER(1)),
+		SE_ARRAY(packed + 3 * VID_PAGE_PACKED_SIZE, Video::VID_PAGE_PACKED_SIZE, Serializer::SES_INT8, VER(1)),
 		SE_END()
 	};
 	ser.saveOrLoadEntries(entries);
 	if (ser._mode == Serializer::SM_LOAD) {
-		_curPagePtr1 = _pagePtrs[(mask >> 4) & 0x3];
-		_curPagePtr2 = _pagePtrs[(mask >> 2) & 0x3];
-		_curPagePtr3 = _pagePtrs[(mask >> 0) & 0x3];
+		if (_trace) {
+			_trace->writeState(_curPal, _newPal, mask, packed, 4 * VID_PAGE_PACKED_SIZE);
+		}
+		loadPages(packed, mask);
 		changePal(_curPal);
 	}
+	free(packed);
 }
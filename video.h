@@ -20,6 +20,11 @@
 #define __VIDEO_H__
 
 #include "intern.h"
+#include "pagecache.h"
+#include "shapecache.h"
+#include "spancache.h"
+#include "spanfill.h"
+#include "workerpool.h"
 
 struct StrEntry {
 	uint16 id;
@@ -38,15 +43,131 @@ struct Polygon {
 	void init(const uint8 *p, uint16 zoom);
 };
 
+struct RenderTrace;
 struct Resource;
 struct Serializer;
 struct SystemStub;
 
-struct Video {
-	typedef void (Video::*drawLine)(int16 x1, int16 x2, uint8 col);
+// the polygon rasterizer, the bands of rows drawn by the workers each get
+// a copy of it clipped to their rows
+struct Raster {
+	enum {
+		FILL_N, // color
+		FILL_P, // copy of page 0
+		FILL_T  // transparency bit
+	};
+
+	enum {
+		VID_PAGE_W = 320,
+		VID_PAGE_H = 200,
+		VID_PAGE_PACKED_SIZE = VID_PAGE_W * VID_PAGE_H / 2, // two pixels per byte, as in the save files
+		DIRTY_BLOCK_W = 16, // at 320x200, the blocks grow with the page size
+		DIRTY_BLOCK_H = 8,
+		DIRTY_COLS = 320 / DIRTY_BLOCK_W,
+		DIRTY_ROWS = 200 / DIRTY_BLOCK_H,
+		DIRTY_ALL = (1 << DIRTY_COLS) - 1,
+		MAX_DIRTY_RECTS = DIRTY_COLS * DIRTY_ROWS / 2
+	};
+
+	enum {
+		MAX_STRING_IDS = 0x400,
+		FONT_GLYPHS = 96 // characters 0x20 to 0x7F
+	};
+
+	static uint16 _interpTable[0x400];
+	static const StrEntry *_stringsIndex[MAX_STRING_IDS]; // by id, 0 if missing
+	static uint64 _fontMasks[FONT_GLYPHS * 8]; // the bytes of the pixels set in each row of a glyph are 0xFF
+
+	uint16 _w, _h; // page size, larger than 320x200 the game coordinates are scaled
+	uint32 _pitch; // one byte per pixel, rows are 64 bytes aligned
+	uint32 _pageSize;
+	bool _hires;
+	uint8 _dirtyShiftX, _dirtyShiftY;
+	uint8 *_pagePtrs[4]; // buffer of each page, copies of a page share it
+	uint8 *_curPagePtr1;
+	uint32 *_curDirty1;
+	int16 _clipY1, _clipY2; // page rows drawn
+	const SpanKernels *_spans;
+	SpanCache *_spanRecorder; // set while the spans of a shape are recorded
+	Polygon _pg;
+	int16 _hliney;
+
+	Raster() : _spanRecorder(0) {}
+
+	void drawShapeList(const ShapeCache::List *l, uint16 zoom, const Point &pt);
+	void fillPolygon(uint16 color, uint16 zoom, const Point &pt);
+	template <int MODE> void fillPolygon(uint8 color, const Point &pt);
+	template <int MODE> void fillPolygonHires(uint8 color, const Point &pt);
+	template <int MODE> void drawSpan(int16 x1, int16 x2, uint8 color);
+	int32 calcStep(const Point &p1, const Point &p2, uint16 &dy);
+	void renderString(uint8 color, uint16 x, uint16 y, uint16 strId);
+	void drawChar(uint8 c, uint16 x, uint16 y, uint8 color);
+	void drawPoint(uint8 color, int16 x, int16 y);
+	void drawLineT(int16 x1, int16 x2, uint8 color);
+	void drawLineN(int16 x1, int16 x2, uint8 color);
+	void drawLineP(int16 x1, int16 x2, uint8 color);
+	void fillRows(uint8 color);
+
+	// first page column or row at or after the game coordinate, 16.16 fixed point
+	int16 toPageX(int32 x) const {
+		return ((int64)x * _w / VID_PAGE_W + 0x7FFF) >> 16;
+	}
+	int16 toPageY(int32 y) const {
+		return ((int64)y * _h / VID_PAGE_H + 0x7FFF) >> 16;
+	}
+	void markDirty(uint32 *mask, int16 x1, int16 y1, int16 x2, int16 y2) {
+		const uint32 bits = (2 << (x2 >> _dirtyShiftX)) - (1 << (x1 >> _dirtyShiftX));
+		for (int y = y1 >> _dirtyShiftY; y <= y2 >> _dirtyShiftY; ++y) {
+			mask[y] |= bits;
+		}
+	}
+	void markAllDirty(uint32 *mask);
+};
 
+struct Video : Raster {
 	enum {
-		VID_PAGE_SIZE  = 320 * 200 / 2
+		DC_FILL,
+		DC_SHAPE,
+		DC_STRING
+	};
+
+	// drawing deferred until the page is read, see resolveDrawList()
+	struct DrawCmd {
+		uint8 type;
+		uint8 color;
+		uint16 zoom;
+		uint16 offset; // DC_SHAPE offset in dataBuf, DC_STRING string id
+		int16 x, y;
+		uint8 *dataBuf;
+	};
+
+	enum {
+		MAX_DRAW_CMDS = 256
+	};
+
+	enum {
+		MAX_PAGE_BUFS = 8 + PageCache::MAX_PAGES, // the pages, the sources of their pending scrolls and the cached backgrounds
+		NO_PAGE_BUF = 0xFF
+	};
+
+	// a scroll copy to a page, applied before the page is read or written
+	struct PageScroll {
+		uint8 buf;
+		int16 dy;
+	};
+
+	struct DrawList {
+		DrawCmd cmds[MAX_DRAW_CMDS];
+		uint16 numCmds;
+		bool readsPage0; // contains polygons copying page 0
+	};
+
+	// rows of the page drawn by a worker, the rows of a band cover whole
+	// dirty blocks so the bands never write the same mask words
+	struct RasterBand {
+		Raster raster;
+		uint16 cmds[MAX_DRAW_CMDS]; // commands of the list touching the band
+		uint16 numCmds;
 	};
 
 	static const uint8 _font[];
@@ -57,37 +178,77 @@ struct Video {
 	SystemStub *_stub;
 
 	uint8 _newPal, _curPal;
-	uint8 *_pagePtrs[4];
-	uint8 *_curPagePtr1, *_curPagePtr2, *_curPagePtr3;
-	Polygon _pg;
-	int16 _hliney;
-	uint16 _interpTable[0x400];
+	uint8 _curPage1, _curPage2, _curPage3;
+	uint8 *_pageBufs[MAX_PAGE_BUFS];
+	uint8 _pageBufRefs[MAX_PAGE_BUFS]; // pages and scrolls using the buffer
+	uint8 _pageBufNums[4];
+	PageScroll _pageScrolls[4];
+	uint32 _dirtyMasks[4][DIRTY_ROWS]; // blocks which may differ from the screen, one bit per block
+	Rect _dirtyRects[MAX_DIRTY_RECTS];
+	ShapeCache _shapes;
+	SpanCache _spanCache;
+	PageCache _pageCache;
+	bool _deferred;
+	DrawList _drawLists[4];
+	WorkerPool _rasterPool;
+	RasterBand _bands[DIRTY_ROWS];
+	uint8 _numBands;
+	const DrawList *_bandList;
+	const ShapeCache::List *_bandShapes[MAX_DRAW_CMDS];
 	Ptr _pData;
 	uint8 *_dataBuf;
+	RenderTrace *_trace; // records the calls for render_bench, 0 when off
 
 	Video(Resource *res, SystemStub *stub);
-	void init();
+	~Video();
+	void init(uint16 w = VID_PAGE_W, uint16 h = VID_PAGE_H);
+	void initWorkers(int numThreads);
+	void freeWorkers();
+	void indexStrings(const StrEntry *table);
+	void startTrace(const char *filename, const char *directory);
+	void stopTrace();
 
 	void setDataBuffer(uint8 *dataBuf, uint16 offset);
 	void drawShape(uint8 color, uint16 zoom, const Point &pt);
-	void fillPolygon(uint16 color, uint16 zoom, const Point &pt);
-	void drawShapeParts(uint16 zoom, const Point &pt);
-	int32 calcStep(const Point &p1, const Point &p2, uint16 &dy);
+	void renderShape(uint8 color, uint16 zoom, const Point &pt);
+	const ShapeCache::List *getShapeList(uint8 color, uint16 zoom);
+	void drawSpans(const SpanCache::List *l);
+	void compileShape(ShapeCache::List *l, uint8 color, uint16 zoom, const Point &pt);
+	void compileShapeParts(ShapeCache::List *l, uint16 zoom, const Point &pt);
 
 	void drawString(uint8 color, uint16 x, uint16 y, uint16 strId);
-	void drawChar(uint8 c, uint16 x, uint16 y, uint8 color, uint8 *buf);
-	void drawPoint(uint8 color, int16 x, int16 y);
-	void drawLineT(int16 x1, int16 x2, uint8 color);
-	void drawLineN(int16 x1, int16 x2, uint8 color);
-	void drawLineP(int16 x1, int16 x2, uint8 color);
-	uint8 *getPagePtr(uint8 page);
+	uint8 getPageNum(uint8 page);
+	DrawCmd *addDrawCmd(uint8 num, uint8 type, bool readsPage0);
+	void resolveDrawList(uint8 num);
+	void rasterizeDrawList(uint8 num);
+	void binDrawCmd(uint16 i, int16 y1, int16 y2);
+	void drawBand(RasterBand *band);
+	static void drawBandJob(void *param, int job);
+	void resolveDrawLists();
+	void resolvePage0Readers();
+	void dropDrawList(uint8 num);
+	void beginPageRead(uint8 num);
+	void beginPageWrite(uint8 num, bool whole);
+	uint8 allocPageBuf();
+	void setPageBuf(uint8 num, uint8 buf);
+	void dropPageScroll(uint8 num);
+	void ownPage(uint8 num, bool whole);
 	void changePagePtr1(uint8 page);
+	void clearPage(uint8 *p, uint8 color);
 	void fillPage(uint8 page, uint8 color);
 	void copyPage(uint8 src, uint8 dst, int16 vscroll);
 	void copyPagePtr(const uint8 *src);
+	bool loadCachedPage(uint16 resNum);
+	void cachePage(uint16 resNum);
 	uint8 *allocPage();
+	void expandRow(uint8 *page, int16 y, const uint8 *src);
+	void packPage(uint8 *dst, const uint8 *src);
+	void unpackPage(uint8 *dst, const uint8 *src);
+	uint16 getDirtyRects(const uint32 *mask);
 	void changePal(uint8 pal);
 	void updateDisplay(uint8 page);
+	uint32 getPageChecksum(uint8 num);
+	void loadPages(const uint8 *packed, uint8 mask);
 	
 	void saveOrLoad(Serializer &ser);
 };
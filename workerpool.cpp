@@ -0,0 +1,103 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "workerpool.h"
+#include "systemstub.h"
+
+
+WorkerPool::WorkerPool(SystemStub *stub)
+	: _stub(stub), _numWorkers(0), _doneSem(0), _quit(false) {
+}
+
+void WorkerPool::init(int numWorkers) {
+	if (numWorkers > MAX_WORKERS) {
+		numWorkers = MAX_WORKERS;
+	}
+	_quit = false;
+	_doneSem = _stub->createSemaphore(0);
+	for (int i = 0; i < numWorkers; ++i) {
+		Worker *w = &_workers[i];
+		w->pool = this;
+		w->num = i + 1; // the calling thread runs the jobs of worker 0
+		w->startSem = _stub->createSemaphore(0);
+		w->thread = _stub->createThread(threadProc, w);
+	}
+	_numWorkers = numWorkers;
+	debug(DBG_INFO, "WorkerPool::init() %d worker threads", _numWorkers);
+}
+
+void WorkerPool::free() {
+	_quit = true;
+	for (int i = 0; i < _numWorkers; ++i) {
+		_stub->postSemaphore(_workers[i].startSem);
+	}
+	for (int i = 0; i < _numWorkers; ++i) {
+		_stub->waitThread(_workers[i].thread);
+		_stub->destroySemaphore(_workers[i].startSem);
+	}
+	if (_doneSem) {
+		_stub->destroySemaphore(_doneSem);
+		_doneSem = 0;
+	}
+	_numWorkers = 0;
+}
+
+void WorkerPool::run(JobProc proc, void *param, int numJobs) {
+	int active = numJobs - 1;
+	if (active > _numWorkers) {
+		active = _numWorkers;
+	}
+	if (active <= 0) {
+		for (int i = 0; i < numJobs; ++i) {
+			(*proc)(param, i);
+		}
+		return;
+	}
+	// the semaphores order the job parameters and the results between threads
+	_proc = proc;
+	_param = param;
+	_numJobs = numJobs;
+	_stride = active + 1;
+	for (int i = 0; i < active; ++i) {
+		_stub->postSemaphore(_workers[i].startSem);
+	}
+	runJobs(0);
+	for (int i = 0; i < active; ++i) {
+		_stub->waitSemaphore(_doneSem);
+	}
+}
+
+void WorkerPool::runJobs(int num) {
+	for (int i = num; i < _numJobs; i += _stride) {
+		(*_proc)(_param, i);
+	}
+}
+
+int WorkerPool::threadProc(void *param) {
+	Worker *w = (Worker *)param;
+	WorkerPool *pool = w->pool;
+	while (1) {
+		pool->_stub->waitSemaphore(w->startSem);
+		if (pool->_quit) {
+			break;
+		}
+		pool->runJobs(w->num);
+		pool->_stub->postSemaphore(pool->_doneSem);
+	}
+	return 0;
+}
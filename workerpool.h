@@ -0,0 +1,60 @@
+/* Raw - Another World Interpreter
+ * Copyright (C) 2004 Gregory Montoir
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef __WORKERPOOL_H__
+#define __WORKERPOOL_H__
+
+#include "intern.h"
+
+struct SystemStub;
+
+struct WorkerPool {
+	typedef void (*JobProc)(void *param, int job);
+
+	enum {
+		MAX_WORKERS = 15
+	};
+
+	struct Worker {
+		WorkerPool *pool;
+		int num;
+		void *thread;
+		void *startSem;
+	};
+
+	SystemStub *_stub;
+	Worker _workers[MAX_WORKERS];
+	int _numWorkers;
+	void *_doneSem;
+	JobProc _proc;
+	void *_param;
+	int _numJobs;
+	int _stride;
+	bool _quit;
+
+	WorkerPool(SystemStub *stub);
+
+	void init(int numWorkers);
+	void free();
+	void run(JobProc proc, void *param, int numJobs);
+	void runJobs(int num);
+
+	static int threadProc(void *param);
+};
+
+#endif